@@ -10,9 +10,14 @@
 
 
 #include "pssc/util/IDGenerator.h"
+#include "pssc/util/LatencyHistogram.h"
 
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <unordered_map>
 #include <list>
+#include <vector>
 
 #include "pssc/transport/tcp/TCPServer.h"
 #include "types.h"
@@ -26,21 +31,123 @@ using namespace trs;
 class Core
 {
 public:
-    Core(int port);
+    // how calls of a service advertised by several nodes are spread among them
+    enum class ServiceBalancing : std::uint8_t
+    {
+        ROUND_ROBIN,
+        LEAST_OUTSTANDING,  // to the node with the fewest calls not responded yet
+        CALLER_HASH,        // calls of a caller go to the same node while it is there
+    };
+
+    // the core dispatches messages on threadCount threads
+    Core(int port, size_t threadCount = 1);
     int Start();
+
+    // messages of topics queued for a node are capped at maxQueuedBytes,
+    // the rest is dropped. Set it before Start.
+    inline void SetMaxQueuedBytes(size_t maxQueuedBytes)
+    {
+        this->maxQueuedBytes = maxQueuedBytes;
+    }
+
+    // set it before Start
+    inline void SetServiceBalancing(ServiceBalancing balancing)
+    {
+        this->srvBalancing = balancing;
+    }
 private:
+    struct PeerEndpoint
+    {
+        std::string address;
+        std::uint16_t port;
+    };
+
+    // counters of a topic, updated by Publish without locks
+    struct TopicStats
+    {
+        std::atomic<std::uint64_t> messagesIn;
+        std::atomic<std::uint64_t> bytesIn;
+        std::atomic<std::uint64_t> messagesOut;
+        std::atomic<std::uint64_t> bytesOut;
+        std::atomic<std::uint64_t> dropped;
+
+        TopicStats() : messagesIn(0), bytesIn(0), messagesOut(0), bytesOut(0), dropped(0) {}
+    };
+
+    struct Topic
+    {
+        pssc_topic_id id;
+        std::string name;
+        std::list<pssc_id> subscribers;
+        // queue limits the subscribers asked for
+        std::unordered_map<pssc_id, util::QueueLimit> limits;
+        // nodes publishing the topic directly to its subscribers
+        std::list<pssc_id> advertisers;
+        std::shared_ptr<TopicStats> stats;
+    };
+
+    struct RouteEntry
+    {
+        pssc_id nodeId;
+        std::shared_ptr<TCPConnection> conn;
+        util::QueueLimit limit;
+        // the node accepts peers, skipped for messages relayed to peerless subscribers only
+        bool direct;
+    };
+    // subscribers of a topic, never modified once published
+    struct Route
+    {
+        std::vector<RouteEntry> entries;
+        std::shared_ptr<TopicStats> stats;
+    };
+    // routes indexed by topic id - 1, replaced as a whole on every change
+    using RoutingTable = std::vector<std::shared_ptr<const Route>>;
+
+    struct ServiceProvider
+    {
+        pssc_id nodeId;
+        // calls sent to the node and not responded yet
+        std::atomic<size_t> outstanding;
+
+        ServiceProvider(pssc_id nodeId) : nodeId(nodeId), outstanding(0) {}
+    };
+
+    struct Service
+    {
+        std::vector<std::shared_ptr<ServiceProvider>> providers;
+        // for ROUND_ROBIN
+        std::atomic<size_t> next;
+
+        Service() : next(0) {}
+    };
+
     std::unique_ptr<TCPServer> server;
+    size_t maxQueuedBytes;
+    ServiceBalancing srvBalancing;
 
     IDGenerator<std::uint64_t> nodeIdGen;
 
     pssc_rw_mutex rwlckNodes;
     std::unordered_map<pssc_id, std::shared_ptr<TCPConnection>> nodes;
+    std::unordered_map<pssc_id, PeerEndpoint> endpoints;
 
     pssc_rw_mutex rwlckTopics;
-    std::unordered_map<std::string, std::list<pssc_id>> topics;
+    // topic ids are interned at SUBSCRIBE and ADVERTISE_TOPIC and never reused,
+    // the topic with id n is topics[n - 1]
+    std::unordered_map<std::string, pssc_topic_id> topicIds;
+    std::vector<Topic> topics;
+    // read by Publish without locks, only with std::atomic_load
+    std::shared_ptr<const RoutingTable> routes;
 
     pssc_rw_mutex rwlckSrvs;
-    std::unordered_map<std::string, pssc_id> srvs;
+    std::unordered_map<std::string, Service> srvs;
+
+    std::mutex mtxCalls;
+    // (caller id, message id) -> provider, of the calls not responded yet
+    std::map<std::pair<pssc_id, pssc_id>, std::shared_ptr<ServiceProvider>> calls;
+
+    // time DispatchMessage took per instruction, unknown ones count as UNKOWN
+    util::LatencyHistogram dispatchLatencies[Ins::UNKOWN + 1];
 
     void OnConnected(std::shared_ptr<TCPConnection> conn);
     void OnDisconnected(std::shared_ptr<TCPConnection> conn);
@@ -56,6 +163,19 @@ private:
     void ResponseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg);
     void CloseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg);
     void QuerySubNum(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg);
+    void AdvertiseTopic(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg);
+    void QueryMetrics(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg);
+
+    // rwlckTopics should be locked
+    pssc_topic_id InternTopic(const std::string& name);
+    Topic* FindTopic(pssc_topic_id topicId);
+    Topic* FindTopic(const std::string& name);
+    void FillSubscribers(const Topic& topic, TopicSubscribersMessage& msg);
+    void UpdateRoute(const Topic& topic);
+    void NotifyAdvertisers(const Topic& topic);
+    // rwlckSrvs should be locked
+    std::shared_ptr<ServiceProvider> ChooseProvider(Service& srv, pssc_id callerId);
+    void FailCall(pssc_id callerId, pssc_id messageId);
 };
 
 };
@@ -28,6 +28,12 @@ enum Instruction
     SERVICE_RESPONSE,
     QUERY_SUBSCRIBER_NUMBER,
     QUERY_SUBSCRIBER_NUMBER_ACK,
+    SHM_PUBLISH,
+    ADVERTISE_TOPIC,
+    ADVTOPICACK,
+    TOPIC_SUBSCRIBERS,
+    QUERY_METRICS,
+    QUERY_METRICS_ACK,
     UNKOWN,
 };
 
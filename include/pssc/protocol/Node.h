@@ -8,36 +8,64 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <map>
 #include <thread>
 #include <functional>
+#include <future>
 #include <glog/logging.h>
 #include "pssc/transport/tcp/TCPClient.h"
+#include "pssc/transport/tcp/TCPServer.h"
+#include "pssc/transport/shm/SHMSegment.h"
 #include "pssc/util/IDGenerator.h"
 #include "Instruction.h"
 #include "types.h"
 #include "pssc/util/Notifier.h"
+#include "pssc/util/Executor.h"
+#include "pssc/util/RingBuffer.h"
 #include "pssc/protocol/msgs/pssc_msgs.h"
+#include "pssc/protocol/RequestTable.h"
 
 namespace pssc {
 
 using trs::TCPMessage;
 using trs::TCPClient;
+using trs::TCPServer;
 using trs::TCPConnection;
+using trs::SHMSegment;
 
 class Node
 {
+    static const std::uint32_t DEFAULT_SHM_SLOT_COUNT = 8;
+    // ring capacity of an inbox without a depth, more messages wait in its overflow
+    static const size_t DEFAULT_INBOX_CAPACITY = 4096;
+    // messages an inbox hands to the callbacks before letting other keys run
+    static const size_t MAX_DRAIN_BATCH = 64;
 
 public:
+    // called with the payload of each message of the topic subscribed
+    using TopicHandler = std::function<void(std::uint8_t*, size_t)>;
+
+    // may be kept to respond later from any thread, the payload of the call stays valid
+    // until it is released. The call fails if it is released without a response.
     class ResponseOperator
     {
         pssc_id callerId;
         pssc_id messageId;
         std::shared_ptr<TCPConnection> conn;
+        std::shared_ptr<TCPMessage> request;
+        std::atomic_bool responded;
 
         friend class Node;
     public:
+        ResponseOperator() : callerId(0), messageId(0), responded(false) {}
+        ResponseOperator(const ResponseOperator&) = delete;
+        ~ResponseOperator();
+
+        // only the first response is sent
         void SendResponse(bool success,
                 std::uint8_t* data, size_t size);
     };
@@ -58,52 +86,204 @@ public:
         pssc_bytes data;
     };
 
+    // called once with the response of a call, unsuccessful if it timed out or was cancelled
+    using CallCallback = std::function<void(std::shared_ptr<ResponseData>)>;
+
+    // a writable region for the payload of a message to publish, see Loan
+    class PublishLoan
+    {
+        std::string topic;
+        pssc_topic_id topicId;
+        std::shared_ptr<TCPMessage> msg;
+        std::shared_ptr<SHMSegment> segment;
+        std::uint32_t slot;
+        pssc_bytes data;
+        size_t size;
+        // when it was loaned if tracing, else 0
+        std::uint64_t loanedAt;
+
+        friend class Node;
+    public:
+        PublishLoan() : topicId(0), slot(0), data(nullptr), size(0), loanedAt(0) {}
+        PublishLoan(const PublishLoan&) = delete;
+        ~PublishLoan()
+        {
+            // given back without being committed
+            if (segment != nullptr && data != nullptr)
+            {
+                segment->Abort(slot);
+            }
+        }
+
+        inline pssc_bytes GetData() { return data; }
+        inline size_t GetSize() { return size; }
+    };
+
 private:
+    struct Peer
+    {
+        std::shared_ptr<TCPClient> client;
+        std::shared_ptr<TCPConnection> conn;
+    };
+    using Subscribers = std::vector<TopicSubscribersMessage::Subscriber>;
+
+    // messages received for one topic or service, waiting for the executor.
+    // Without a depth nothing is dropped: messages that do not fit into the ring
+    // wait in the overflow, after those in the ring.
+    // Up to workers tasks drain it at once, each taking one message at a time.
+    struct Inbox
+    {
+        util::RingBuffer<std::shared_ptr<TCPMessage>> ring;
+        util::QueueLimit limit;
+        size_t workers;
+        // per worker, a task draining the ring is posted or running
+        std::unique_ptr<std::atomic_bool[]> scheduled;
+        std::mutex mtxOverflow;
+        std::deque<std::shared_ptr<TCPMessage>> overflow;
+        std::atomic<size_t> overflowed;
+
+        Inbox(const util::QueueLimit& limit, size_t workers = 1)
+            : ring(limit.depth > 0 ? limit.depth : DEFAULT_INBOX_CAPACITY),
+              limit(limit), workers(workers > 0 ? workers : 1),
+              scheduled(new std::atomic_bool[this->workers]), overflowed(0)
+        {
+            for (size_t i = 0; i < this->workers; ++i)
+            {
+                scheduled[i] = false;
+            }
+        }
+
+        inline bool Bounded() const
+        {
+            return limit.depth > 0;
+        }
+    };
+
+    // replaced as a whole when the handler changes
+    struct TopicEntry
+    {
+        std::string name;
+        // topicCallback is called if empty
+        TopicHandler handler;
+        std::shared_ptr<Inbox> inbox;
+    };
+
     std::shared_ptr<TCPClient> client;
     std::shared_ptr<TCPConnection> conn;
     std::uint64_t nodeId;
     IDGenerator<std::uint64_t> messageIdGen;
     bool running;
-    std::unordered_map<pssc_id, std::function<void()>> mapAckNoti;
-    std::thread execPub, execCall;
+    // requests sent to the core waiting for their responses
+    std::unique_ptr<RequestTable> requests;
+    size_t executorThreads;
+    // runs topic and service callbacks, in order per topic and per service
+    std::unique_ptr<util::Executor> executor;
+    std::atomic<std::uint64_t> droppedMessages;
+    // calls of a service wait in one inbox drained by srvConcurrency workers
+    size_t srvConcurrency;
+    pssc_rw_mutex rwlckSrvInboxes;
+    std::unordered_map<std::string, std::shared_ptr<Inbox>> srvInboxes;
 
     util::Notifier startNoti;
 
-    std::mutex mtxMsg;
-    std::condition_variable cvMsg;
-    std::mutex mtxCall;
-    std::condition_variable cvCall;
-    std::list<std::shared_ptr<TCPMessage>> msgList;
-    std::list<std::shared_ptr<TCPMessage>> callList;
-
-    std::mutex mtxAcks;
-    std::unordered_map<std::uint64_t, std::shared_ptr<TCPMessage>> acks;
 
+    pssc_rw_mutex rwlckTopics;
+    // ids interned by the core for the topics this node subscribes or publishes
+    std::unordered_map<std::string, pssc_topic_id> topicIds;
+    std::unordered_map<pssc_topic_id, std::shared_ptr<const TopicEntry>> topicEntries;
+    // message id of SUBSCRIBE -> entry to install when its ack arrives
+    std::unordered_map<pssc_id, std::shared_ptr<const TopicEntry>> pendingSubs;
 
     std::function<void(std::string, std::uint8_t*, size_t)> topicCallback;
     std::function<void(std::string, std::uint8_t*, size_t, std::shared_ptr<ResponseOperator>)> srvCallback;
 
+    size_t shmThreshold;
+    std::uint32_t shmSlotCount;
+    IDGenerator<std::uint64_t> shmIdGen;
+    std::mutex mtxSHM;
+    // topic -> segment written by this node
+    std::unordered_map<std::string, std::shared_ptr<SHMSegment>> shmWriters;
+    // (publisher, topic id) -> segment mapped for reading
+    std::map<std::pair<pssc_id, pssc_topic_id>, std::shared_ptr<SHMSegment>> shmReaders;
+    // address of this node as the core sees it, shared with the subscribers on this host
+    std::string localAddress;
+
+    bool directPublish;
+    size_t maxPeerQueuedBytes;
+    std::shared_ptr<TCPServer> peerServer;
+    std::thread peerThread;
+    pssc_rw_mutex rwlckPeers;
+    // topics advertised by this node -> their subscribers
+    std::unordered_map<std::string, std::shared_ptr<const Subscribers>> topicSubscribers;
+    std::unordered_map<pssc_id, Peer> peers;
+    // clients of peers gone, stopped but kept: their detached io threads may still
+    // be unwinding and they must not be destroyed on those threads
+    std::vector<std::shared_ptr<TCPClient>> retiredPeerClients;
+
 private:
-    void ExecPublish();
-    void ExecCall();
-    bool SendRequestAndWaitForResponse(pssc_id messageId, std::shared_ptr<TCPMessage> req, std::shared_ptr<TCPMessage>& resp);
+    static std::shared_ptr<const TopicEntry> MakeTopicEntry(const std::string& topic,
+            TopicHandler handler, const util::QueueLimit& limit);
+    // hands msg to exec on the executor, keeping the order of key. The workers of
+    // the inbox run with the keys from key on, so they run in parallel
+    void Deliver(std::uint64_t key, std::shared_ptr<Inbox> inbox, std::shared_ptr<TCPMessage> msg,
+            std::function<void(std::shared_ptr<TCPMessage>)> exec);
+    void DrainInbox(std::uint64_t key, std::shared_ptr<Inbox> inbox, size_t worker,
+            std::function<void(std::shared_ptr<TCPMessage>)> exec);
+    // the oldest message of the ring, or of the overflow once the ring is empty
+    static bool TakeFromInbox(Inbox& inbox, std::shared_ptr<TCPMessage>& msg);
+    std::shared_ptr<Inbox> GetServiceInbox(const std::string& srv_name);
+    void ExecPublish(std::shared_ptr<TCPMessage> msg, std::shared_ptr<const TopicEntry> entry);
+    void ExecSHMPublish(std::shared_ptr<TCPMessage> msg, std::shared_ptr<const TopicEntry> entry);
+    // false if a payload of size does not fit the 32 bit length of a message
+    bool PrepareLoan(PublishLoan& loan, std::string& topic, size_t size);
+    std::shared_ptr<TCPMessage> CommitLoan(PublishLoan& loan, bool feedback);
+    void SendPublish(std::string& topic, pssc_topic_id topicId, std::shared_ptr<TCPMessage> msg, bool feedback);
+    std::shared_ptr<SHMSegment> GetSHMWriter(std::string& topic, size_t size);
+    std::shared_ptr<SHMSegment> GetSHMReader(pssc_id publisherId, pssc_topic_id topicId, std::string& name);
+    // false if a subscriber of the topic can not map the segments of this node
+    bool SubscribersOnThisHost(std::string& topic);
+    // keeps the handler of the topic if it has one
+    void AddTopicId(pssc_topic_id topicId, const std::string& topic);
+    void SetTopicEntry(pssc_topic_id topicId, std::shared_ptr<const TopicEntry> entry);
+    // advertises the topic to get its id if it is not known yet, 0 on failure
+    pssc_topic_id GetTopicId(std::string& topic);
+    std::shared_ptr<const TopicEntry> GetTopicEntry(pssc_topic_id topicId);
+    void ExecCall(std::shared_ptr<TCPMessage> msg);
+    // messageId is added to requests without a handler
+    bool SendRequestAndWaitForResponse(pssc_id messageId, std::shared_ptr<TCPMessage> req, std::shared_ptr<TCPMessage>& resp,
+            TCPConnection::Priority priority = TCPConnection::Priority::CONTROL);
+    std::shared_ptr<TCPMessage> MakeServiceCall(pssc_id messageId, const std::string& srv_name,
+            std::uint8_t* data, size_t size);
 
     void OnConntected(std::shared_ptr<TCPConnection> conn);
     void OnDisconntected(std::shared_ptr<TCPConnection> conn);
 
-    void OnMessageReceived(std::shared_ptr<TCPMessage> msg);
     void DispatchMessage(std::shared_ptr<TCPMessage> msg);
+    // messages of peer connections, only publishes are accepted
+    void DispatchPeerMessage(std::shared_ptr<TCPMessage> msg);
 
 
     void OnGenerelResponse(std::shared_ptr<TCPMessage> msg);
     void OnRegACK(std::shared_ptr<TCPMessage> msg);
+    void OnSubACK(std::shared_ptr<TCPMessage> msg);
 
     void OnPublish(std::shared_ptr<TCPMessage> msg);
     void OnSrvCall(std::shared_ptr<TCPMessage> msg);
+    void OnTopicSubscribers(pssc_ins ins, std::shared_ptr<TCPMessage> msg);
+
+    void OnPeerConnected(std::shared_ptr<TCPConnection> conn);
+    void OnPeerDisconnected(std::shared_ptr<TCPConnection> conn);
+    // rwlckPeers should be locked
+    void RetirePeerClient(std::shared_ptr<TCPClient> client);
+    void PublishDirectly(std::string& topic, pssc_topic_id topicId, std::shared_ptr<TCPMessage> msg, bool feedback);
+    // advertises the topic to learn its subscribers if they are not known yet, nullptr on failure
+    std::shared_ptr<const Subscribers> GetTopicSubscribers(std::string& topic);
+    std::shared_ptr<TCPConnection> GetPeerConnection(const TopicSubscribersMessage::Subscriber& subscriber);
 
 public:
 
-    Node()
+    Node() : executorThreads(1), droppedMessages(0), srvConcurrency(1), shmThreshold(0), shmSlotCount(DEFAULT_SHM_SLOT_COUNT), directPublish(false),
+            maxPeerQueuedBytes(TCPConnection::DEFAULT_MAX_QUEUED_BYTES)
     {
         topicCallback = [](std::string, std::uint8_t*, size_t){};
         srvCallback = [](std::string, std::uint8_t*, size_t, std::shared_ptr<ResponseOperator>){};
@@ -111,18 +291,46 @@ public:
 
     bool Initialize(int port);
 
+    // messages of subscribed topics dropped by their queue limits in this node or
+    // because their shared memory was reused, and messages published directly that
+    // the limits of their subscribers dropped
+    std::uint64_t GetDroppedMessages();
+
     pssc_size QuerySubNum(std::string topic);
-    void Publish(std::string topic, std::uint8_t* data, size_t size, bool feedback = false);
+    // counters of the core, nullptr if it did not answer
+    std::shared_ptr<MetricsMessage> QueryMetrics();
+    // false if size does not fit the 32 bit length of a message, nothing is published then
+    bool Publish(std::string topic, std::uint8_t* data, size_t size, bool feedback = false);
+    // fill GetData() of the loan in place and commit it, the payload is not copied again,
+    // GetData() is nullptr if size does not fit the 32 bit length of a message
+    std::shared_ptr<PublishLoan> Loan(std::string topic, size_t size);
+    void Commit(std::shared_ptr<PublishLoan> loan, bool feedback = false);
+    bool AdvertiseTopic(std::string topic);
     bool Subscribe(std::string topic);
+    // messages of the topic go to handler instead of the topic callback if it is set.
+    // At most limit.depth messages of the topic wait for the node in the core and
+    // for the handler in the node; no depth means no bound.
+    bool Subscribe(std::string topic, TopicHandler handler, util::QueueLimit limit = util::QueueLimit());
     bool UnSubscribe(std::string topic);
+    // other nodes may advertise the service too, the core spreads the calls among them
     bool AdvertiseService(std::string srv_name);
     bool CloseService(std::string srv_name);
-    std::shared_ptr<Node::ResponseData> RemoteCall(std::string srv_name, std::uint8_t* data, size_t size);
+    // waits for the response, for at most timeout unless it is 0
+    std::shared_ptr<Node::ResponseData> RemoteCall(std::string srv_name, std::uint8_t* data, size_t size,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    // returns at once with the id of the call, data may be released then. callback runs
+    // on the executor, after the callbacks of other calls completed before it.
+    pssc_id RemoteCallAsync(std::string srv_name, std::uint8_t* data, size_t size, CallCallback callback,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    std::future<std::shared_ptr<Node::ResponseData>> RemoteCallAsync(std::string srv_name,
+            std::uint8_t* data, size_t size, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    // completes the call as unsuccessful, false if it has completed already
+    bool CancelCall(pssc_id callId);
 
 
 
 
-    // on message received
+    // on message received of topics subscribed without a handler
     void SetTopicCallback(std::function<void(std::string, std::uint8_t*, size_t)> topicCallback)
     {
         this->topicCallback = topicCallback;
@@ -133,6 +341,48 @@ public:
     {
         this->srvCallback = srvCallback;
     }
+
+    // callbacks of different topics and services run on up to threadCount threads,
+    // those of the same topic or service still run one at a time. Set it before Initialize.
+    void SetExecutorThreads(size_t threadCount)
+    {
+        this->executorThreads = threadCount;
+    }
+
+    // up to concurrency calls of the same service run at once, on the executor threads.
+    // Calls of a service are no longer handled in order then. Set it before Initialize.
+    void SetServiceConcurrency(size_t concurrency)
+    {
+        this->srvConcurrency = concurrency > 0 ? concurrency : 1;
+    }
+
+    // payloads not smaller than threshold are published through shared memory,
+    // only a descriptor goes through the core. Topics with a subscriber on another
+    // host are published over tcp. 0 disables it.
+    // A topic keeps its latest slotCount payloads: slots are reused in turn once no
+    // callback reads them, so a subscriber more than slotCount messages behind drops
+    // those whose slots were reused, counted in GetDroppedMessages.
+    void SetSharedMemoryThreshold(size_t threshold, std::uint32_t slotCount = DEFAULT_SHM_SLOT_COUNT)
+    {
+        this->shmThreshold = threshold;
+        this->shmSlotCount = slotCount;
+    }
+
+    // send published messages to the subscribers directly instead of through the core,
+    // which then only tells the subscribers of each topic. Set before Initialize, it
+    // also makes the node accept messages published directly by others; subscribers
+    // that did not set it still get the messages through the core.
+    void SetDirectPublish(bool directPublish)
+    {
+        this->directPublish = directPublish;
+    }
+
+    // messages published directly and queued for a peer are capped at maxQueuedBytes,
+    // the rest is dropped, as the core does for its nodes
+    void SetMaxPeerQueuedBytes(size_t maxQueuedBytes)
+    {
+        this->maxPeerQueuedBytes = maxQueuedBytes;
+    }
 };
 
 };
@@ -0,0 +1,228 @@
+/*
+ * RequestTable.h
+ *
+ *  Created on: May 13, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_REQUEST_TABLE_H_
+#define INCLUDE_PSSC_PROTOCOL_REQUEST_TABLE_H_
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pssc/transport/tcp/TCPMessage.h"
+#include "types.h"
+
+namespace pssc
+{
+
+// requests waiting for their responses. The id of a request is the index of its slot
+// and the generation of the slot, a slot is reused as soon as its request completes
+// and a late response to the old request does not complete the new one.
+class RequestTable
+{
+public:
+    // the response, or nullptr if the request timed out or was cancelled
+    using Handler = std::function<void(std::shared_ptr<trs::TCPMessage>)>;
+
+    explicit RequestTable(boost::asio::io_service& ioService) : ioService(ioService), closed(false) {}
+
+    RequestTable(const RequestTable&) = delete;
+    RequestTable& operator=(const RequestTable&) = delete;
+
+    // the response goes to handler, or to Wait if handler is empty.
+    // The request fails after timeout unless it is 0, or at once after CompleteAll.
+    pssc_id Add(Handler handler, std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        std::uint32_t index;
+        if (freeSlots.empty())
+        {
+            index = slots.size();
+            slots.emplace_back();
+        }
+        else
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        auto& slot = slots[index];
+        slot.pending = true;
+        slot.done = false;
+        slot.handler = std::move(handler);
+        pssc_id id = MakeId(index, slot.generation);
+
+        if (closed)
+        {
+            // no response will come any more
+            slot.pending = false;
+            if (!slot.handler)
+            {
+                slot.done = true;
+                return id;
+            }
+            handler = std::move(slot.handler);
+            slot.handler = nullptr;
+            Release(id);
+            lck.unlock();
+            handler(nullptr);
+            return id;
+        }
+
+        if (timeout.count() > 0)
+        {
+            if (slot.timer == nullptr)
+            {
+                slot.timer = std::make_unique<boost::asio::steady_timer>(ioService);
+            }
+            slot.timer->expires_after(timeout);
+            slot.timer->async_wait([this, id](const boost::system::error_code& ec)
+            {
+                if (!ec)
+                {
+                    Complete(id, nullptr);
+                }
+            });
+        }
+        return id;
+    }
+
+    // false if id is not pending, it completed already
+    bool Complete(pssc_id id, std::shared_ptr<trs::TCPMessage> resp)
+    {
+        Handler handler;
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            auto slot = Find(id);
+            if (slot == nullptr)
+            {
+                return false;
+            }
+
+            slot->pending = false;
+            if (slot->timer != nullptr)
+            {
+                slot->timer->cancel();
+            }
+
+            if (!slot->handler)
+            {
+                // Wait releases the slot
+                slot->resp = std::move(resp);
+                slot->done = true;
+                slot->cv.notify_one();
+                return true;
+            }
+
+            handler = std::move(slot->handler);
+            slot->handler = nullptr;
+            Release(id);
+        }
+
+        handler(resp);
+        return true;
+    }
+
+    // blocks until the request added without a handler completes
+    std::shared_ptr<trs::TCPMessage> Wait(pssc_id id)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        auto& slot = slots[IndexOf(id)];
+        slot.cv.wait(lck, [&slot]() { return slot.done; });
+
+        auto resp = std::move(slot.resp);
+        slot.resp = nullptr;
+        Release(id);
+        return resp;
+    }
+
+    // fails every pending request and those added from now on
+    void CompleteAll()
+    {
+        std::vector<pssc_id> ids;
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            closed = true;
+            for (std::uint32_t i = 0; i < slots.size(); ++i)
+            {
+                if (slots[i].pending)
+                {
+                    ids.push_back(MakeId(i, slots[i].generation));
+                }
+            }
+        }
+
+        for (auto id : ids)
+        {
+            Complete(id, nullptr);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        std::uint32_t generation = 0;
+        // waiting for its response
+        bool pending = false;
+        // completed, for Wait
+        bool done = false;
+        Handler handler;
+        std::shared_ptr<trs::TCPMessage> resp;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        std::condition_variable cv;
+    };
+
+    boost::asio::io_service& ioService;
+    std::mutex mtx;
+    // a deque, so slots are not moved when it grows
+    std::deque<Slot> slots;
+    std::vector<std::uint32_t> freeSlots;
+    // set by CompleteAll
+    bool closed;
+
+    static inline pssc_id MakeId(std::uint32_t index, std::uint32_t generation)
+    {
+        return (static_cast<pssc_id>(generation) << 32) | index;
+    }
+
+    static inline std::uint32_t IndexOf(pssc_id id)
+    {
+        return static_cast<std::uint32_t>(id);
+    }
+
+    Slot* Find(pssc_id id)
+    {
+        auto index = IndexOf(id);
+        if (index >= slots.size())
+        {
+            return nullptr;
+        }
+        auto& slot = slots[index];
+        if (!slot.pending || MakeId(index, slot.generation) != id)
+        {
+            return nullptr;
+        }
+        return &slot;
+    }
+
+    void Release(pssc_id id)
+    {
+        auto index = IndexOf(id);
+        ++slots[index].generation;
+        freeSlots.push_back(index);
+    }
+};
+
+}
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_REQUEST_TABLE_H_ */
@@ -0,0 +1,51 @@
+/*
+ * AdvertiseTopicMessage.h
+ *
+ *  Created on: May 5, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_MSGS_ADVERTISETOPICMESSAGE_H_
+#define INCLUDE_PSSC_PROTOCOL_MSGS_ADVERTISETOPICMESSAGE_H_
+
+#include "PSSCMessage.h"
+
+namespace pssc {
+
+class AdvertiseTopicMessage : public PSSCMessage
+{
+public:
+    // | INS | ID | ADVERTISER_ID | SIZE_OF_TOPIC | TOPIC |
+    static const pssc_ins INS = Ins::ADVERTISE_TOPIC;
+    static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2 + SIZE_OF_SIZE;
+
+    pssc_id advertiserId;
+    std::string topic;
+
+    AdvertiseTopicMessage() = default; // @suppress("Class members should be properly initialized")
+
+    AdvertiseTopicMessage(std::shared_ptr<TCPMessage> msg)
+    {
+        // INS has been taken
+        msg->NextData(messageId);
+        msg->NextData(advertiserId);
+        msg->NextData(topic);
+    }
+
+    std::shared_ptr<TCPMessage> toTCPMessage() override
+    {
+        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY + topic.size());
+        msg->AppendData(INS);
+        msg->AppendData(messageId);
+        msg->AppendData(advertiserId);
+        msg->AppendData(topic);
+        return msg;
+    }
+};
+
+}
+
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_MSGS_ADVERTISETOPICMESSAGE_H_ */
@@ -0,0 +1,180 @@
+/*
+ * MetricsMessage.h
+ *
+ *  Created on: May 15, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_MSGS_METRICSMESSAGE_H_
+#define INCLUDE_PSSC_PROTOCOL_MSGS_METRICSMESSAGE_H_
+
+#include <vector>
+#include "PSSCMessage.h"
+#include "pssc/util/LatencyHistogram.h"
+
+namespace pssc {
+
+class MetricsMessage : public PSSCMessage
+{
+public:
+    // counters of the core since it started, bytes are those of message bodies.
+    // | INS | ID | COUNT | TOPIC * COUNT | COUNT | NODE * COUNT | COUNT | DISPATCH * COUNT |
+    // TOPIC: | TOPIC_ID | SIZE_OF_TOPIC | TOPIC | SUBSCRIBERS | MSGS_IN | BYTES_IN | MSGS_OUT | BYTES_OUT | DROPPED |
+    // NODE: | NODE_ID | MSGS_IN | BYTES_IN | MSGS_OUT | BYTES_OUT | DROPPED | QUEUED_MSGS | QUEUED_BYTES |
+    // DISPATCH: | INS | BUCKET * LatencyHistogram::BUCKET_COUNT |
+    static const pssc_ins INS = Ins::QUERY_METRICS_ACK;
+    static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID + SIZE_OF_SIZE * 3;
+    static const pssc_size SIZE_OF_TOPIC_NECCESSARY =
+            SIZE_OF_TOPIC_ID + SIZE_OF_SIZE * 2 + sizeof(std::uint64_t) * 5;
+    static const pssc_size SIZE_OF_NODE =
+            SIZE_OF_PSSC_ID + sizeof(std::uint64_t) * 7;
+    static const pssc_size SIZE_OF_DISPATCH =
+            SIZE_OF_PSSC_INS + sizeof(std::uint64_t) * util::LatencyHistogram::BUCKET_COUNT;
+
+    struct TopicCounters
+    {
+        pssc_topic_id topicId;
+        std::string topic;
+        pssc_size subscribers;
+        // published to the core
+        std::uint64_t messagesIn;
+        std::uint64_t bytesIn;
+        // queued for the subscribers
+        std::uint64_t messagesOut;
+        std::uint64_t bytesOut;
+        // dropped by the queue limits of the subscribers
+        std::uint64_t dropped;
+    };
+
+    // the connection of a node to the core
+    struct NodeCounters
+    {
+        pssc_id nodeId;
+        std::uint64_t messagesIn;
+        std::uint64_t bytesIn;
+        std::uint64_t messagesOut;
+        std::uint64_t bytesOut;
+        std::uint64_t dropped;
+        std::uint64_t queuedMessages;
+        std::uint64_t queuedBytes;
+    };
+
+    // how long the core took to handle the messages of an instruction
+    struct DispatchLatency
+    {
+        pssc_ins ins;
+        std::uint64_t buckets[util::LatencyHistogram::BUCKET_COUNT];
+    };
+
+    std::vector<TopicCounters> topics;
+    std::vector<NodeCounters> nodes;
+    std::vector<DispatchLatency> dispatches;
+
+    MetricsMessage() // @suppress("Class members should be properly initialized")
+    {
+        messageId = 0;
+    }
+
+    MetricsMessage(std::shared_ptr<TCPMessage> msg)
+    {
+        // INS has been taken
+        pssc_size count;
+        msg->NextData(messageId);
+
+        msg->NextData(count);
+        topics.resize(count);
+        for (auto& topic : topics)
+        {
+            msg->NextData(topic.topicId);
+            msg->NextData(topic.topic);
+            msg->NextData(topic.subscribers);
+            msg->NextData(topic.messagesIn);
+            msg->NextData(topic.bytesIn);
+            msg->NextData(topic.messagesOut);
+            msg->NextData(topic.bytesOut);
+            msg->NextData(topic.dropped);
+        }
+
+        msg->NextData(count);
+        nodes.resize(count);
+        for (auto& node : nodes)
+        {
+            msg->NextData(node.nodeId);
+            msg->NextData(node.messagesIn);
+            msg->NextData(node.bytesIn);
+            msg->NextData(node.messagesOut);
+            msg->NextData(node.bytesOut);
+            msg->NextData(node.dropped);
+            msg->NextData(node.queuedMessages);
+            msg->NextData(node.queuedBytes);
+        }
+
+        msg->NextData(count);
+        dispatches.resize(count);
+        for (auto& dispatch : dispatches)
+        {
+            msg->NextData(dispatch.ins);
+            for (auto& bucket : dispatch.buckets)
+            {
+                msg->NextData(bucket);
+            }
+        }
+    }
+
+    std::shared_ptr<TCPMessage> toTCPMessage() override
+    {
+        auto size = SIZE_OF_MESSAGE_NECCESSARY + SIZE_OF_NODE * nodes.size()
+                + SIZE_OF_DISPATCH * dispatches.size();
+        for (auto& topic : topics)
+        {
+            size += SIZE_OF_TOPIC_NECCESSARY + topic.topic.size();
+        }
+
+        auto msg = TCPMessage::Generate(size);
+        msg->AppendData(INS);
+        msg->AppendData(messageId);
+
+        msg->AppendData((pssc_size)topics.size());
+        for (auto& topic : topics)
+        {
+            msg->AppendData(topic.topicId);
+            msg->AppendData(topic.topic);
+            msg->AppendData(topic.subscribers);
+            msg->AppendData(topic.messagesIn);
+            msg->AppendData(topic.bytesIn);
+            msg->AppendData(topic.messagesOut);
+            msg->AppendData(topic.bytesOut);
+            msg->AppendData(topic.dropped);
+        }
+
+        msg->AppendData((pssc_size)nodes.size());
+        for (auto& node : nodes)
+        {
+            msg->AppendData(node.nodeId);
+            msg->AppendData(node.messagesIn);
+            msg->AppendData(node.bytesIn);
+            msg->AppendData(node.messagesOut);
+            msg->AppendData(node.bytesOut);
+            msg->AppendData(node.dropped);
+            msg->AppendData(node.queuedMessages);
+            msg->AppendData(node.queuedBytes);
+        }
+
+        msg->AppendData((pssc_size)dispatches.size());
+        for (auto& dispatch : dispatches)
+        {
+            msg->AppendData(dispatch.ins);
+            for (auto bucket : dispatch.buckets)
+            {
+                msg->AppendData(bucket);
+            }
+        }
+        return msg;
+    }
+};
+
+}
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_MSGS_METRICSMESSAGE_H_ */
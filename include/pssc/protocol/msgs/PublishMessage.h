@@ -18,43 +18,73 @@ private:
     std::shared_ptr<TCPMessage> msg;
 
 public:
-    // | INS | ID | PUBLISHER_ID | SIZE_OF_TOPIC | TOPIC | SIZE_OF_DATA | DATA | FEEDBACK |
+    // | INS | ID | PUBLISHER_ID | TOPIC_ID | SIZE_OF_DATA | DATA | FEEDBACK | RELAY |
     static const pssc_ins INS = Ins::PUBLISH;
     static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
-            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2 + SIZE_OF_SIZE * 2 + SIZE_OF_BOOL;
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2 + SIZE_OF_TOPIC_ID + SIZE_OF_SIZE + SIZE_OF_BOOL + sizeof(std::uint8_t);
+
+    // RELAY, the subscribers the core forwards the message to: all of them, or only
+    // those not accepting peers when the publisher sent it to the others itself
+    static const std::uint8_t RELAY_ALL = 0;
+    static const std::uint8_t RELAY_PEERLESS = 1;
 
     pssc_id publisherId;
-    std::string topic;
-    size_t sizeOfData;
+    pssc_topic_id topicId;
+    pssc_size sizeOfData;
     pssc_bytes data;
     bool feedback;
+    std::uint8_t relay;
 
-    PublishMessage() : feedback(false), data(nullptr) {} // @suppress("Class members should be properly initialized")
+    PublishMessage() : feedback(false), data(nullptr), relay(RELAY_ALL) {} // @suppress("Class members should be properly initialized")
 
     PublishMessage(std::shared_ptr<TCPMessage> msg) : msg(msg)
     {
         // INS has been taken
         msg->NextData(messageId);
         msg->NextData(publisherId);
-        msg->NextData(topic);
+        msg->NextData(topicId);
         msg->NextData(sizeOfData);
         data = msg->GetDataPointerWithOffset();
         msg->IgnoreBytes(sizeOfData);
         msg->NextData(feedback);
+        msg->NextData(relay);
     }
 
     std::shared_ptr<TCPMessage> toTCPMessage() override
     {
-        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY + topic.size() + sizeOfData);
+        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY + sizeOfData);
         msg->AppendData(INS);
         msg->AppendData(messageId);
         msg->AppendData(publisherId);
-        msg->AppendData(topic);
+        msg->AppendData(topicId);
         msg->AppendData(sizeOfData);
         msg->AppendData(data, sizeOfData);
         msg->AppendData(feedback);
+        msg->AppendData(relay);
+        return msg;
+    }
+
+    // writes the fields before DATA and points data at its place in the message,
+    // the caller fills it and appends FEEDBACK and RELAY afterwards.
+    std::shared_ptr<TCPMessage> toTCPMessageInPlace()
+    {
+        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY + sizeOfData);
+        msg->AppendData(INS);
+        msg->AppendData(messageId);
+        msg->AppendData(publisherId);
+        msg->AppendData(topicId);
+        msg->AppendData(sizeOfData);
+        data = msg->GetDataPointerWithOffset();
+        msg->IgnoreBytes(sizeOfData);
         return msg;
     }
+
+    // RELAY is the last byte of both PUBLISH and SHM_PUBLISH,
+    // set it before the message is handed to any connection
+    static void SetRelay(std::shared_ptr<TCPMessage> msg, std::uint8_t relay)
+    {
+        msg->body[msg->header.bodyLength - 1] = relay;
+    }
 };
 
 }
@@ -0,0 +1,48 @@
+/*
+ * QueryMetricsMessage.h
+ *
+ *  Created on: May 15, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_MSGS_QUERYMETRICSMESSAGE_H_
+#define INCLUDE_PSSC_PROTOCOL_MSGS_QUERYMETRICSMESSAGE_H_
+
+
+#include "PSSCMessage.h"
+
+namespace pssc {
+
+class QueryMetricsMessage : public PSSCMessage
+{
+public:
+    // | INS | ID | INQUIRER_ID |
+    static const pssc_ins INS = Ins::QUERY_METRICS;
+    static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2;
+
+    pssc_id inquirerId;
+
+    QueryMetricsMessage() = default; // @suppress("Class members should be properly initialized")
+
+    QueryMetricsMessage(std::shared_ptr<TCPMessage> msg)
+    {
+        // INS has been taken
+        msg->NextData(messageId);
+        msg->NextData(inquirerId);
+    }
+
+    std::shared_ptr<TCPMessage> toTCPMessage() override
+    {
+        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY);
+        msg->AppendData(INS);
+        msg->AppendData(messageId);
+        msg->AppendData(inquirerId);
+        return msg;
+    }
+};
+
+}
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_MSGS_QUERYMETRICSMESSAGE_H_ */
@@ -15,16 +15,20 @@ namespace pssc {
 class RegisterMessage : public PSSCMessage
 {
 public:
-    // | INS | ID |
+    // | INS | ID | PEER_PORT |
     static const pssc_ins INS = Ins::REGISTER;
-    static const pssc_size SIZE_OF_MESSAGE = SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID;
+    static const pssc_size SIZE_OF_MESSAGE = SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID + SIZE_OF_PORT;
 
-    RegisterMessage() = default; // @suppress("Class members should be properly initialized")
+    // port on which the node accepts direct connections from publishers, 0 for none
+    std::uint16_t peerPort;
+
+    RegisterMessage() : peerPort(0) {} // @suppress("Class members should be properly initialized")
 
     RegisterMessage(std::shared_ptr<TCPMessage> msg)
     {
         // INS has been taken
         msg->NextData(messageId);
+        msg->NextData(peerPort);
     }
 
     std::shared_ptr<TCPMessage> toTCPMessage() override
@@ -32,6 +36,7 @@ public:
         auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE);
         msg->AppendData(INS);
         msg->AppendData(messageId);
+        msg->AppendData(peerPort);
         return msg;
     }
 };
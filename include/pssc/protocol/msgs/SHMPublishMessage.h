@@ -0,0 +1,77 @@
+/*
+ * SHMPublishMessage.h
+ *
+ *  Created on: May 3, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_MSGS_SHMPUBLISHMESSAGE_H_
+#define INCLUDE_PSSC_PROTOCOL_MSGS_SHMPUBLISHMESSAGE_H_
+
+#include "PSSCMessage.h"
+#include "PublishMessage.h"
+
+namespace pssc {
+
+class SHMPublishMessage : public PSSCMessage
+{
+public:
+    // same layout as PUBLISH, DATA is a descriptor of the payload in shared memory,
+    // so that the core can route it as an usual PublishMessage.
+    // | INS | ID | PUBLISHER_ID | TOPIC_ID | SIZE_OF_DATA | DATA | FEEDBACK | RELAY |
+    // DATA: | SIZE_OF_SEGMENT | SEGMENT | SLOT | SEQ | SIZE_OF_PAYLOAD |
+    static const pssc_ins INS = Ins::SHM_PUBLISH;
+    static const pssc_size SIZE_OF_MESSAGE_NECCESSARY = PublishMessage::SIZE_OF_MESSAGE_NECCESSARY;
+    static const pssc_size SIZE_OF_DESCRIPTOR_NECCESSARY =
+            SIZE_OF_SIZE * 2 + sizeof(std::uint32_t) + sizeof(std::uint64_t);
+
+    pssc_id publisherId;
+    pssc_topic_id topicId;
+    std::string segment;
+    std::uint32_t slot;
+    std::uint64_t seq;
+    pssc_size sizeOfPayload;
+    bool feedback;
+    std::uint8_t relay;
+
+    SHMPublishMessage() : feedback(false), relay(PublishMessage::RELAY_ALL) {} // @suppress("Class members should be properly initialized")
+
+    SHMPublishMessage(std::shared_ptr<TCPMessage> msg)
+    {
+        // INS has been taken
+        pssc_size sizeOfData;
+        msg->NextData(messageId);
+        msg->NextData(publisherId);
+        msg->NextData(topicId);
+        msg->NextData(sizeOfData);
+        msg->NextData(segment);
+        msg->NextData(slot);
+        msg->NextData(seq);
+        msg->NextData(sizeOfPayload);
+        msg->NextData(feedback);
+        msg->NextData(relay);
+    }
+
+    std::shared_ptr<TCPMessage> toTCPMessage() override
+    {
+        pssc_size sizeOfData = SIZE_OF_DESCRIPTOR_NECCESSARY + segment.size();
+        auto msg = TCPMessage::Generate(SIZE_OF_MESSAGE_NECCESSARY + sizeOfData);
+        msg->AppendData(INS);
+        msg->AppendData(messageId);
+        msg->AppendData(publisherId);
+        msg->AppendData(topicId);
+        msg->AppendData(sizeOfData);
+        msg->AppendData(segment);
+        msg->AppendData(slot);
+        msg->AppendData(seq);
+        msg->AppendData(sizeOfPayload);
+        msg->AppendData(feedback);
+        msg->AppendData(relay);
+        return msg;
+    }
+};
+
+}
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_MSGS_SHMPUBLISHMESSAGE_H_ */
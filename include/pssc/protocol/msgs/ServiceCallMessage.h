@@ -25,7 +25,7 @@ public:
 
     pssc_id callerId;
     std::string srv_name;
-    size_t sizeOfData;
+    pssc_size sizeOfData;
     pssc_bytes data;
 
     ServiceCallMessage() : data(nullptr) {} // @suppress("Class members should be properly initialized")
@@ -26,7 +26,7 @@ public:
 
     pssc_id callerId;
     bool success;
-    size_t sizeOfData;
+    pssc_size sizeOfData;
     pssc_bytes data;
 
     ServiceResponseMessage() : data(nullptr), sizeOfData(0u) {} // @suppress("Class members should be properly initialized")
@@ -15,19 +15,22 @@ namespace pssc {
 class SubACKMessage : public PSSCMessage
 {
 public:
-    // | INS | ID | SUCCESS |
+    // | INS | ID | SUCCESS | TOPIC_ID |
     static const pssc_ins INS = Ins::SUBACK;
-    static const pssc_size SIZE_OF_MESSAGE = SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID + SIZE_OF_BOOL;
+    static const pssc_size SIZE_OF_MESSAGE = SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID + SIZE_OF_BOOL + SIZE_OF_TOPIC_ID;
 
     bool success;
+    // the id PUBLISH messages of the topic carry
+    pssc_topic_id topicId;
 
-    SubACKMessage() = default; // @suppress("Class members should be properly initialized")
+    SubACKMessage() : success(false), topicId(0) {} // @suppress("Class members should be properly initialized")
 
     SubACKMessage(std::shared_ptr<TCPMessage> msg)
     {
         // INS has been taken
         msg->NextData(messageId);
         msg->NextData(success);
+        msg->NextData(topicId);
     }
 
     std::shared_ptr<TCPMessage> toTCPMessage() override
@@ -36,6 +39,7 @@ public:
         msg->AppendData(INS);
         msg->AppendData(messageId);
         msg->AppendData(success);
+        msg->AppendData(topicId);
         return msg;
     }
 };
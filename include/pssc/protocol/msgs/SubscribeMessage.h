@@ -15,13 +15,15 @@ namespace pssc {
 class SubscribeMessage : public PSSCMessage
 {
 public:
-    // | INS | ID | SUBSCRIBER_ID | SIZE_OF_TOPIC | TOPIC |
+    // | INS | ID | SUBSCRIBER_ID | SIZE_OF_TOPIC | TOPIC | QUEUE_DEPTH | QUEUE_POLICY |
     static const pssc_ins INS = Ins::SUBSCRIBE;
     static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
-            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2 + SIZE_OF_SIZE;
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID * 2 + SIZE_OF_SIZE * 2 + sizeof(std::uint8_t);
 
     pssc_id subscriberId;
     std::string topic;
+    // how many messages of the topic may wait for the subscriber in the core
+    util::QueueLimit limit;
 
     SubscribeMessage() = default; // @suppress("Class members should be properly initialized")
 
@@ -31,6 +33,12 @@ public:
         msg->NextData(messageId);
         msg->NextData(subscriberId);
         msg->NextData(topic);
+
+        pssc_size depth;
+        std::uint8_t policy;
+        msg->NextData(depth);
+        msg->NextData(policy);
+        limit = util::QueueLimit(depth, (util::QueuePolicy)policy);
     }
 
     std::shared_ptr<TCPMessage> toTCPMessage() override
@@ -40,6 +48,8 @@ public:
         msg->AppendData(messageId);
         msg->AppendData(subscriberId);
         msg->AppendData(topic);
+        msg->AppendData((pssc_size)limit.depth);
+        msg->AppendData((std::uint8_t)limit.policy);
         return msg;
     }
 };
@@ -0,0 +1,102 @@
+/*
+ * TopicSubscribersMessage.h
+ *
+ *  Created on: May 5, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef INCLUDE_PSSC_PROTOCOL_MSGS_TOPICSUBSCRIBERSMESSAGE_H_
+#define INCLUDE_PSSC_PROTOCOL_MSGS_TOPICSUBSCRIBERSMESSAGE_H_
+
+#include <vector>
+#include "PSSCMessage.h"
+#include "pssc/util/QueueLimit.h"
+
+namespace pssc {
+
+class TopicSubscribersMessage : public PSSCMessage
+{
+public:
+    // sent as ADVTOPICACK to answer ADVERTISE_TOPIC,
+    // and as TOPIC_SUBSCRIBERS to advertisers whenever the subscribers change.
+    // | INS | ID | TOPIC_ID | SIZE_OF_TOPIC | TOPIC | COUNT | SUBSCRIBER * COUNT |
+    // SUBSCRIBER: | NODE_ID | SIZE_OF_ADDRESS | ADDRESS | PORT | QUEUE_DEPTH | QUEUE_POLICY |
+    static const pssc_size SIZE_OF_MESSAGE_NECCESSARY =
+            SIZE_OF_PSSC_INS + SIZE_OF_PSSC_ID + SIZE_OF_TOPIC_ID + SIZE_OF_SIZE * 2;
+    static const pssc_size SIZE_OF_SUBSCRIBER_NECCESSARY =
+            SIZE_OF_PSSC_ID + SIZE_OF_SIZE * 2 + SIZE_OF_PORT + sizeof(std::uint8_t);
+
+    struct Subscriber
+    {
+        pssc_id nodeId;
+        std::string address;
+        std::uint16_t port;
+        // how many messages of the topic may wait for the subscriber in a publisher
+        util::QueueLimit limit;
+    };
+
+    pssc_topic_id topicId;
+    std::string topic;
+    std::vector<Subscriber> subscribers;
+
+    TopicSubscribersMessage(pssc_ins ins = Ins::TOPIC_SUBSCRIBERS) // @suppress("Class members should be properly initialized")
+    {
+        this->ins = ins;
+        messageId = 0;
+        topicId = 0;
+    }
+
+    TopicSubscribersMessage(pssc_ins ins, std::shared_ptr<TCPMessage> msg)
+    {
+        // INS has been taken
+        pssc_size count;
+        this->ins = ins;
+        msg->NextData(messageId);
+        msg->NextData(topicId);
+        msg->NextData(topic);
+        msg->NextData(count);
+        subscribers.resize(count);
+        for (auto& subscriber : subscribers)
+        {
+            msg->NextData(subscriber.nodeId);
+            msg->NextData(subscriber.address);
+            msg->NextData(subscriber.port);
+
+            pssc_size depth;
+            std::uint8_t policy;
+            msg->NextData(depth);
+            msg->NextData(policy);
+            subscriber.limit = util::QueueLimit(depth, (util::QueuePolicy)policy);
+        }
+    }
+
+    std::shared_ptr<TCPMessage> toTCPMessage() override
+    {
+        auto size = SIZE_OF_MESSAGE_NECCESSARY + topic.size();
+        for (auto& subscriber : subscribers)
+        {
+            size += SIZE_OF_SUBSCRIBER_NECCESSARY + subscriber.address.size();
+        }
+
+        auto msg = TCPMessage::Generate(size);
+        msg->AppendData(ins);
+        msg->AppendData(messageId);
+        msg->AppendData(topicId);
+        msg->AppendData(topic);
+        msg->AppendData((pssc_size)subscribers.size());
+        for (auto& subscriber : subscribers)
+        {
+            msg->AppendData(subscriber.nodeId);
+            msg->AppendData(subscriber.address);
+            msg->AppendData(subscriber.port);
+            msg->AppendData((pssc_size)subscriber.limit.depth);
+            msg->AppendData((std::uint8_t)subscriber.limit.policy);
+        }
+        return msg;
+    }
+};
+
+}
+
+
+#endif /* INCLUDE_PSSC_PROTOCOL_MSGS_TOPICSUBSCRIBERSMESSAGE_H_ */
@@ -23,6 +23,11 @@
 #include "CloseSrvACKMessage.h"
 #include "QuerySubNumMessage.h"
 #include "QuerySubNumACKMessage.h"
+#include "SHMPublishMessage.h"
+#include "AdvertiseTopicMessage.h"
+#include "TopicSubscribersMessage.h"
+#include "QueryMetricsMessage.h"
+#include "MetricsMessage.h"
 
 
 #endif /* INCLUDE_PSSC_PROTOCOL_MSGS_PSSC_MSGS_H_ */
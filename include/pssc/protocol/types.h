@@ -18,15 +18,19 @@
 
 #define SIZE_OF_PSSC_INS sizeof(std::uint8_t)
 #define SIZE_OF_PSSC_ID sizeof(std::uint64_t)
-#define SIZE_OF_SIZE sizeof(size_t)
+#define SIZE_OF_SIZE sizeof(std::uint32_t)
 #define SIZE_OF_BOOL sizeof(bool)
+#define SIZE_OF_PORT sizeof(std::uint16_t)
+#define SIZE_OF_TOPIC_ID sizeof(std::uint32_t)
 
 #else /* not BUILD_DEPENDS_ON_PLATFORM */
 
 #define SIZE_OF_PSSC_INS 1u
 #define SIZE_OF_PSSC_ID 8u
-#define SIZE_OF_SIZE sizeof(size_t)
+#define SIZE_OF_SIZE 4u
 #define SIZE_OF_BOOL 1u
+#define SIZE_OF_PORT 2u
+#define SIZE_OF_TOPIC_ID 4u
 
 #endif /* BUILD_DEPENDS_ON_PLATFORM */
 
@@ -34,9 +38,12 @@
 
 namespace pssc {
 
-using pssc_size = size_t;
+// lengths are fixed 32-bit fields on the wire
+using pssc_size = std::uint32_t;
 using pssc_ins = std::uint8_t;
 using pssc_id = std::uint64_t;
+// interned by the core, 0 is never assigned
+using pssc_topic_id = std::uint32_t;
 using pssc_byte = std::uint8_t;
 using pssc_bytes = std::uint8_t*;
 
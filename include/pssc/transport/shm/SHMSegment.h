@@ -0,0 +1,89 @@
+/*
+ * SHMSegment.h
+ *
+ *  Created on: May 3, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef SHM_SEGMENT_H_
+#define SHM_SEGMENT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace trs
+{
+
+/*
+ * A named POSIX shared memory segment split into fixed-size slots.
+ * The owner (publisher) writes payloads into free slots, readers on the
+ * same host map the segment by name and read a slot in place.
+ *
+ * Every slot carries a sequence number: odd while being written, even
+ * when stable. A reader locks a slot with the sequence it was told about
+ * and gets nothing if the slot has been reused in between; the writer
+ * never reuses a slot while a reader holds it. Slots whose descriptors are
+ * still on their way are not held, so a segment keeps the latest payloads.
+ */
+class SHMSegment
+{
+public:
+    static const std::uint32_t MAGIC = 0x50535343; // "PSSC"
+
+    static std::shared_ptr<SHMSegment> Create(const std::string& name,
+            size_t slotSize, std::uint32_t slotCount);
+    static std::shared_ptr<SHMSegment> Open(const std::string& name);
+
+    virtual ~SHMSegment();
+
+    // writer side
+    std::uint8_t* Acquire(size_t size, std::uint32_t& slot);
+    std::uint64_t Commit(std::uint32_t slot, size_t size);
+    void Abort(std::uint32_t slot);
+
+    // reader side
+    std::uint8_t* Lock(std::uint32_t slot, std::uint64_t seq, size_t size);
+    void Unlock(std::uint32_t slot);
+
+    inline const std::string& GetName() { return name; }
+    inline size_t GetSlotSize() { return slotSize; }
+
+private:
+    struct SegmentHeader
+    {
+        std::uint32_t magic;
+        std::uint32_t slotCount;
+        std::uint64_t slotSize;
+    };
+
+    struct SlotHeader
+    {
+        std::atomic<std::uint64_t> seq;
+        std::atomic<std::uint32_t> readers;
+        std::uint32_t reserved;
+        std::uint64_t size;
+    };
+
+    SHMSegment() = default;
+
+    SlotHeader* GetSlot(std::uint32_t slot);
+    inline std::uint8_t* GetSlotData(std::uint32_t slot)
+    {
+        return (std::uint8_t*)GetSlot(slot) + sizeof(SlotHeader);
+    }
+
+    std::string name;
+    bool owner;
+    void* base;
+    size_t length;
+    size_t slotSize;
+    size_t slotStride;
+    std::uint32_t slotCount;
+    std::atomic<std::uint32_t> nextSlot;
+};
+
+}
+
+#endif /* SHM_SEGMENT_H_ */
@@ -0,0 +1,81 @@
+/*
+ * BufferPool.h
+ *
+ *  Created on: May 8, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace trs
+{
+
+/*
+ * Recycles message bodies. Buffers are grouped in power-of-two size classes,
+ * a released buffer is kept for the next allocation of the same class
+ * unless the pool already caches too much. Buffers larger than the largest
+ * class are allocated and freed directly.
+ */
+class BufferPool
+{
+public:
+    static constexpr size_t MIN_CLASS_SHIFT = 6;    // 64 B
+    static constexpr size_t MAX_CLASS_SHIFT = 26;   // 64 MB
+    static constexpr size_t DEFAULT_MAX_CACHED_BYTES = 256 * 1024 * 1024;
+    static constexpr size_t DEFAULT_MAX_CACHED_PER_CLASS = 64;
+
+    struct Stats
+    {
+        std::uint64_t allocations;
+        std::uint64_t hits;         // served from the cache
+        std::uint64_t misses;       // new buffer allocated
+        std::uint64_t releases;
+        std::uint64_t frees;        // released buffer freed instead of cached
+        std::uint64_t cachedBytes;
+        std::uint64_t inUseBytes;
+    };
+
+    static BufferPool& Instance();
+
+    // capacity is the real size of the returned buffer, pass it back on release
+    std::uint8_t* Allocate(size_t size, size_t& capacity);
+    void Release(std::uint8_t* buffer, size_t capacity);
+
+    Stats GetStats();
+
+    inline void SetMaxCachedBytes(size_t maxCachedBytes)
+    {
+        this->maxCachedBytes = maxCachedBytes;
+    }
+
+private:
+    struct SizeClass
+    {
+        std::mutex mtx;
+        std::vector<std::uint8_t*> buffers;
+    };
+
+    BufferPool();
+
+    SizeClass classes[MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1];
+    size_t maxCachedBytes;
+
+    std::atomic<std::uint64_t> allocations;
+    std::atomic<std::uint64_t> hits;
+    std::atomic<std::uint64_t> misses;
+    std::atomic<std::uint64_t> releases;
+    std::atomic<std::uint64_t> frees;
+    std::atomic<std::uint64_t> cachedBytes;
+    std::atomic<std::uint64_t> inUseBytes;
+};
+
+}
+
+#endif /* BUFFER_POOL_H_ */
@@ -23,9 +23,17 @@ public:
       std::function<void(std::shared_ptr<TCPConnection>)> on_connected,
       std::function<void(std::shared_ptr<TCPConnection>)> on_disconnected
     );
+    TCPClient(
+      std::string address,
+      int port,
+      std::function<void(std::shared_ptr<TCPConnection>)> on_connected,
+      std::function<void(std::shared_ptr<TCPConnection>)> on_disconnected
+    );
 
     void Connect();
     inline void Disconnect() { ioContext.stop(); }
+    // runs the io of the connection, timers on it fire on the same thread
+    inline boost::asio::io_service& GetIOService() { return ioContext; }
 
 private:
     boost::asio::io_service ioContext;
@@ -9,12 +9,15 @@
 #define TCP_CONNECTION_H_
 
 #include <boost/asio.hpp>
-#include <condition_variable>
+#include <atomic>
 #include <functional>
-#include <list>
-#include <thread>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "TCPMessage.h"
+#include "pssc/util/QueueLimit.h"
 
 namespace trs
 {
@@ -25,6 +28,38 @@ class TCPConnection : public std::enable_shared_from_this<TCPConnection>
 {
     TCPConnection() = default;
 public:
+    static constexpr size_t DEFAULT_MAX_BATCH_BYTES = 256 * 1024;
+    static constexpr size_t DEFAULT_MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t DEFAULT_MAX_FRAGMENT_BYTES = 64 * 1024;
+    static constexpr size_t MIN_FRAGMENT_BYTES = 1024;
+    static constexpr size_t DEFAULT_MAX_REALTIME_BYTES = 16 * 1024;
+    // bytes a class of weight 1 may send in each round of the scheduler
+    static constexpr size_t QUANTUM_BYTES = 4 * 1024;
+
+    // classes of queued messages, each round of the scheduler a class may send
+    // its weight times QUANTUM_BYTES, so no class waits behind a busier one
+    enum class Priority : std::uint8_t
+    {
+        CONTROL,    // registration, acks and subscriber updates
+        SERVICE,    // service calls and responses
+        REALTIME,   // topic messages up to maxRealtimeBytes
+        BULK,       // larger topic messages
+    };
+    static constexpr size_t PRIORITY_COUNT = 4;
+
+    // counters since the connection started, bytes are those of message bodies
+    struct Stats
+    {
+        std::uint64_t messagesIn;
+        std::uint64_t bytesIn;
+        std::uint64_t messagesOut;
+        std::uint64_t bytesOut;
+        std::uint64_t droppedMessages;
+        // waiting in the queues to be sent
+        std::uint64_t queuedMessages;
+        std::uint64_t queuedBytes;
+    };
+
     TCPConnection(const TCPConnection&) = default;
     TCPConnection(std::shared_ptr<tcp::socket> sock,
             std::function<void(std::shared_ptr<TCPConnection>)> funcDisconnected);
@@ -35,24 +70,124 @@ public:
     {
         this->funcMessageReceived = funcMessageReceived;
     }
-    void PendMessage(std::shared_ptr<TCPMessage> msg);
+    void PendMessage(std::shared_ptr<TCPMessage> msg, Priority priority = Priority::CONTROL);
+    // a topic message, sent in order with the other messages of key
+    void PendMessage(std::shared_ptr<TCPMessage> msg, std::uint64_t key, Priority priority);
+    // a message that may be dropped: queued messages of the same key are bounded by limit,
+    // and all of those messages together by maxQueuedBytes.
+    // false if a message of key was dropped for it, this one or an older one.
+    bool PendMessage(std::shared_ptr<TCPMessage> msg, std::uint64_t key, const util::QueueLimit& limit,
+            Priority priority = Priority::REALTIME);
+
+    // queued messages are sent together in one write until it reaches maxBatchBytes,
+    // a single message larger than that is still sent alone.
+    inline void SetMaxBatchBytes(size_t maxBatchBytes)
+    {
+        this->maxBatchBytes = maxBatchBytes;
+    }
+
+    inline void SetMaxQueuedBytes(size_t maxQueuedBytes)
+    {
+        this->maxQueuedBytes = maxQueuedBytes;
+    }
+
+    // bodies larger than maxFragmentBytes are sent in slices of that size, one slice per
+    // write with the smaller messages queued, which may then arrive before them unless
+    // they are topic messages of the same key. 0 disables it, other values are at least
+    // MIN_FRAGMENT_BYTES. A message being sent keeps the slice size it started with.
+    inline void SetMaxFragmentBytes(size_t maxFragmentBytes)
+    {
+        std::lock_guard<std::mutex> lck(mtxSendQueue);
+        this->maxFragmentBytes = maxFragmentBytes > 0 ? std::max(maxFragmentBytes, MIN_FRAGMENT_BYTES) : 0;
+    }
+
+    // REALTIME messages with larger bodies are sent as BULK. Topic messages of a key
+    // follow those of the key still queued instead, so each key is sent in order.
+    inline void SetMaxRealtimeBytes(size_t maxRealtimeBytes)
+    {
+        this->maxRealtimeBytes = maxRealtimeBytes;
+    }
+
+    // set it before Start
+    inline void SetPriorityWeight(Priority priority, size_t weight)
+    {
+        weights[static_cast<size_t>(priority)] = weight > 0 ? weight : 1;
+    }
+
+    inline std::uint64_t GetDroppedMessages() { return droppedMessages; }
+    Stats GetStats();
 
     void Start();
     void Stop();
 
     inline bool IsRunning() { return running; }
+    std::string GetRemoteAddress();
+    std::string GetLocalAddress();
 
 private:
     std::function<void(std::shared_ptr<TCPConnection>)> funcDisconnected;
     std::function<void(std::shared_ptr<TCPMessage>)> funcMessageReceived;
 
     std::shared_ptr<tcp::socket> sock;
+    // keeps the handlers of this connection in order when the io service runs on several threads
+    boost::asio::strand<tcp::socket::executor_type> strand;
     std::atomic_bool running;
 
+    struct PendingMessage
+    {
+        std::shared_ptr<TCPMessage> msg;
+        bool droppable;
+        std::uint64_t key;
+        // a REALTIME or BULK message, counted in keyQueues
+        bool ordered;
+    };
+
+    // the queue topic messages of a key are in while any of them is queued,
+    // PRIORITY_COUNT for bulkQueue
+    struct KeyQueue
+    {
+        size_t queue;
+        size_t count;
+    };
+
     std::mutex mtxSendQueue;
-    std::condition_variable cvSendQueue;
-    std::list<std::shared_ptr<TCPMessage>> sendQueue;
-    std::thread sendThread;
+    // one queue per priority
+    std::deque<PendingMessage> sendQueues[PRIORITY_COUNT];
+    size_t weights[PRIORITY_COUNT];
+    // bytes each class may still send in the current round
+    size_t deficits[PRIORITY_COUNT];
+    size_t maxRealtimeBytes;
+    // messages to send in fragments, in order, the front one is being sent
+    std::deque<PendingMessage> bulkQueue;
+    size_t maxFragmentBytes;
+    // bytes of the front of bulkQueue sent already, in slices of bulkFragmentBytes
+    size_t bulkOffset;
+    size_t bulkFragmentBytes;
+    std::unordered_map<std::uint64_t, KeyQueue> keyQueues;
+    // droppable messages in the queues, per key and in bytes
+    std::unordered_map<std::uint64_t, size_t> queuedCounts;
+    size_t queuedBytes;
+    size_t maxQueuedBytes;
+    std::atomic<std::uint64_t> droppedMessages;
+    // all messages in the queues, for Stats
+    size_t pendingMessages;
+    size_t pendingBytes;
+    std::atomic<std::uint64_t> messagesIn;
+    std::atomic<std::uint64_t> bytesIn;
+    std::atomic<std::uint64_t> messagesOut;
+    std::atomic<std::uint64_t> bytesOut;
+    // a write is in progress, only one at a time
+    bool writing;
+    size_t maxBatchBytes;
+    std::vector<std::shared_ptr<TCPMessage>> sendingMessages;
+    std::vector<TCPMessage::Header> sendingHeaders;
+    std::vector<boost::asio::const_buffer> sendingBuffers;
+    std::uint32_t sendingTotalLength;
+
+    // the message being reassembled from fragments, null if none
+    std::shared_ptr<TCPMessage> receivingMessage;
+    size_t receivedOffset;
+    std::uint32_t receivingTotalLength;
 
     void OnHeaderReceived(std::shared_ptr<TCPConnection> self, std::shared_ptr<TCPMessage::Header> header,
             boost::system::error_code ec, std::size_t receivedLength);
@@ -61,11 +196,27 @@ private:
 
     void ReadHeader();
     void ReadBody(std::shared_ptr<TCPMessage::Header> header);
-
-    void Run();
-
-    void Send(std::shared_ptr<TCPMessage>);
-    bool Send(std::uint8_t* data, size_t size);
+    void ReadFragment(std::shared_ptr<TCPMessage::Header> header);
+    void OnFragmentReceived(std::shared_ptr<TCPConnection> self, std::shared_ptr<TCPMessage::Header> header,
+            size_t length, boost::system::error_code ec, std::size_t receivedLength);
+    void OnFailed();
+    void OnMessageReceived(std::shared_ptr<TCPMessage> msg);
+
+    // mtxSendQueue should be locked
+    void Enqueue(PendingMessage&& pending, Priority priority);
+    // updates the counters of a message taken from the queues
+    void Dequeued(const PendingMessage& pending);
+    // moves messages of sendQueues into sendingMessages, batchBytes are in the batch already
+    void TakeBatch(size_t batchBytes);
+    // adds to the deficits the rounds in which no class could send anything
+    void SkipRounds();
+    // the first droppable message of key in queue from the position from on, end if none
+    std::deque<PendingMessage>::iterator FindDroppable(std::deque<PendingMessage>& queue,
+            std::uint64_t key, size_t from);
+    void StartWriting();
+    void Write();
+    void OnWritten(std::shared_ptr<TCPConnection> self,
+            boost::system::error_code ec, std::size_t writtenLength);
 };
 
 }
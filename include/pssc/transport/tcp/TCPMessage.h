@@ -8,9 +8,14 @@
 #ifndef TCP_MESSAGE_H_
 #define TCP_MESSAGE_H_
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <string.h>
+#include <type_traits>
 #include <netinet/in.h>
+#include "BufferPool.h"
+#include "pssc/util/Tracer.h"
 
 namespace trs
 {
@@ -19,48 +24,64 @@ class TCPMessage : public std::enable_shared_from_this<TCPMessage>
 {
 
 public:
+    // | VERSION | FLAGS | RESERVED(2) | BODY_LENGTH(4, network order) |
+    // FLAG_FRAGMENT frames carry a slice of a larger message, the first one starts with
+    // the length of the whole body (4, network order), FLAG_LAST marks the final slice.
     struct Header
     {
-        std::uint64_t bodyLength;
+        std::uint8_t version;
+        std::uint8_t flags;
+        std::uint16_t reserved;
+        std::uint32_t bodyLength;
 
+        // false if the peer speaks another version of the framing
         inline bool decode()
         {
             bodyLength = ntohl(bodyLength);
-            return bodyLength > 0;
+            return version == VERSION;
         }
 
         inline bool encode()
         {
-            if (bodyLength <= 0)
-            {
-                return false;
-            }
+            version = VERSION;
             bodyLength = htonl(bodyLength);
             return true;
         }
     };
 
+    static const std::uint8_t VERSION = 2;
+    static const std::uint8_t FLAG_FRAGMENT = 0x01;
+    static const std::uint8_t FLAG_LAST = 0x02;
     static const size_t SIZE_OF_HEADER = sizeof(Header);
+    // the length prefix of strings
+    static const size_t SIZE_OF_LENGTH = sizeof(std::uint32_t);
 
     Header header;
 
     std::uint8_t* body;
 
+    // set by the protocol for traced messages, not sent
+    util::TraceContext trace;
+
 public:
 
     TCPMessage()
     {
+        header.version = VERSION;
+        header.flags = 0;
+        header.reserved = 0;
         header.bodyLength = 0;
         body = nullptr;
         release = true;
         offset = 0;
+        capacity = 0;
     }
 
     virtual ~TCPMessage()
     {
         if (release && body != nullptr)
         {
-            delete[] body;
+            BufferPool::Instance().Release(body, capacity);
         }
     }
 
@@ -69,7 +90,7 @@ public:
         auto msg = std::make_shared<TCPMessage>();
         if (size > 0)
         {
-            msg->body = new std::uint8_t[size];
+            msg->body = BufferPool::Instance().Allocate(size, msg->capacity);
         }
         msg->header.bodyLength = size;
         return msg;
@@ -85,7 +106,7 @@ public:
         {
             if (header->bodyLength > 0)
             {
-                msg->body = new std::uint8_t[header->bodyLength];
+                msg->body = BufferPool::Instance().Allocate(header->bodyLength, msg->capacity);
             }
         }
         else
@@ -97,6 +118,19 @@ public:
         return msg;
     }
 
+    // another message over the same body with its own offset, read from the start.
+    // The body is kept until both are gone.
+    std::shared_ptr<TCPMessage> View()
+    {
+        auto msg = std::make_shared<TCPMessage>();
+        msg->header = header;
+        msg->body = body;
+        msg->release = false;
+        msg->trace = trace;
+        msg->owner = shared_from_this();
+        return msg;
+    }
+
     void Reset()
     {
         offset = 0;
@@ -118,6 +152,7 @@ public:
         auto&& size = sizeof(T);
         if (offset + size <= header.bodyLength)
         {
+            data = ToWire(data);
             memcpy(body + offset, &data, size);
             offset += size;
             return true;
@@ -125,15 +160,14 @@ public:
         return false;
     }
 
-    bool AppendData(std::string data)
+    bool AppendData(const std::string& data)
     {
         auto size = data.size();
-        if (offset + size + sizeof(size_t) <= header.bodyLength)
+        if (offset + size + SIZE_OF_LENGTH <= header.bodyLength)
         {
-            memcpy(body + offset, &size, sizeof(size_t));
-            offset += sizeof(size_t);
+            AppendData((std::uint32_t)size);
             memcpy(body + offset, data.c_str(), size);
-            offset += data.size();
+            offset += size;
             return true;
         }
         return false;
@@ -154,22 +188,16 @@ public:
     void NextData(T& data)
     {
         memcpy(&data, body + offset, sizeof(T));
+        data = ToWire(data);
         offset += sizeof(T);
     }
 
     void NextData(std::string& data)
     {
-        size_t size;
-        memcpy(&size, body + offset, sizeof(size_t));
-        offset += sizeof(size_t);
-        auto temp = new char[size + 1];
-        memcpy(temp, body + offset, size);
+        std::uint32_t size;
+        NextData(size);
+        data.assign((const char*)body + offset, size);
         offset += size;
-        temp[size] = '\0';
-
-        std::string str(temp);
-        delete[] temp;
-        data = str;
     }
 
     void NextData(std::uint8_t* data, size_t size)
@@ -178,9 +206,29 @@ public:
         offset += size;
     }
 
+private:
+    // fields of the body are little-endian on the wire, swapping is its own inverse
+    template <typename T>
+    static inline T ToWire(T data)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (std::is_integral<T>::value && sizeof(T) > 1)
+        {
+            std::uint8_t bytes[sizeof(T)];
+            memcpy(bytes, &data, sizeof(T));
+            std::reverse(bytes, bytes + sizeof(T));
+            memcpy(&data, bytes, sizeof(T));
+        }
+#endif
+        return data;
+    }
+
 private:
     size_t offset;
+    size_t capacity;
     bool release;
+    // the message whose body a view reads
+    std::shared_ptr<TCPMessage> owner;
 };
 
 }
@@ -8,6 +8,7 @@
 #ifndef TCP_SERVICE_H_
 #define TCP_SERVICE_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <boost/asio.hpp>
@@ -20,25 +21,31 @@ using boost::asio::ip::tcp;
 
 class TCPServer
 {
-private:
-    static const std::uint64_t DEFAULT_MAX_CONNECTIONS = 100;
 public:
+    static constexpr std::uint64_t DEFAULT_MAX_CONNECTIONS = 100;
+    static constexpr std::uint64_t DEFAULT_THREADS = 1;
+
+    // the io service runs on threadCount threads,
+    // handlers of the same connection are still called one after another.
     TCPServer(
           int port,
           std::function<void(std::shared_ptr<TCPConnection>)> funcConnected,
           std::function<void(std::shared_ptr<TCPConnection>)> funcDisconnected,
-          size_t maxConnection = DEFAULT_MAX_CONNECTIONS
+          size_t maxConnection = DEFAULT_MAX_CONNECTIONS,
+          size_t threadCount = DEFAULT_THREADS
           );
 
     inline void Start() { Run(); }
     inline void Stop() { ioContext.stop(); }
+    inline std::uint16_t GetPort() { return acceptor->local_endpoint().port(); }
 
 private:
     void Accept();
 
 private:
-    size_t currentConnections;
+    std::atomic<size_t> currentConnections;
     size_t maxConnection;
+    size_t threadCount;
     boost::asio::io_service ioContext;
     std::shared_ptr<tcp::acceptor> acceptor;
     tcp::endpoint ep;
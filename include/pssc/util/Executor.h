@@ -0,0 +1,154 @@
+/*
+ * Executor.h
+ *
+ *  Created on: May 10, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_EXECUTOR_H_
+#define PSSC_EXECUTOR_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace util {
+
+// runs tasks on a pool of threads. Tasks posted with the same key run one at a time
+// in the order they were posted, tasks of different keys may run in parallel.
+class Executor
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit Executor(size_t threadCount = 1) : stopped(false)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = 1;
+        }
+
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back(&Executor::Run, this);
+        }
+    }
+
+    ~Executor()
+    {
+        Stop();
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void Post(std::uint64_t key, Task task)
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            auto& queue = queues[key];
+            if (queue == nullptr)
+            {
+                queue = std::make_shared<Queue>();
+            }
+
+            queue->tasks.emplace_back(std::move(task));
+            if (queue->scheduled)
+            {
+                // the thread running the queue takes it later
+                return;
+            }
+            queue->scheduled = true;
+            ready.push_back(queue);
+        }
+        cv.notify_one();
+    }
+
+    // tasks not started yet are dropped
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            if (stopped)
+            {
+                return;
+            }
+            stopped = true;
+        }
+        cv.notify_all();
+
+        for (auto& thread : threads)
+        {
+            if (thread.get_id() == std::this_thread::get_id())
+            {
+                thread.detach();
+            }
+            else if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::deque<Task> tasks;
+        // in ready or being run, so only one thread takes its tasks
+        bool scheduled = false;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<std::uint64_t, std::shared_ptr<Queue>> queues;
+    std::deque<std::shared_ptr<Queue>> ready;
+    std::vector<std::thread> threads;
+    bool stopped;
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (true)
+        {
+            cv.wait(lck, [this]()
+            {
+                return stopped || !ready.empty();
+            });
+            if (stopped)
+            {
+                return;
+            }
+
+            auto queue = ready.front();
+            ready.pop_front();
+            auto task = std::move(queue->tasks.front());
+            queue->tasks.pop_front();
+            lck.unlock();
+
+            task();
+
+            lck.lock();
+            if (queue->tasks.empty())
+            {
+                queue->scheduled = false;
+            }
+            else
+            {
+                // one task at a time, so a busy key does not starve the others
+                ready.push_back(queue);
+                cv.notify_one();
+            }
+        }
+    }
+};
+
+}
+
+
+#endif /* PSSC_EXECUTOR_H_ */
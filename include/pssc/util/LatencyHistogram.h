@@ -0,0 +1,68 @@
+/*
+ * LatencyHistogram.h
+ *
+ *  Created on: May 15, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_LATENCY_HISTOGRAM_H_
+#define PSSC_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// counts of durations in buckets of powers of two microseconds, bucket 0 holds
+// those below 1us, bucket i those in [2^(i-1), 2^i) us and the last one the rest.
+// Recorded from any thread without locks.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t BUCKET_COUNT = 24;
+
+    LatencyHistogram()
+    {
+        for (auto& bucket : buckets)
+        {
+            bucket = 0;
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    inline void Record(std::uint64_t ns)
+    {
+        buckets[BucketOf(ns / 1000)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // counts of the buckets, not taken at a single instant while recording goes on
+    inline void Snapshot(std::uint64_t (&counts)[BUCKET_COUNT]) const
+    {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static inline size_t BucketOf(std::uint64_t us)
+    {
+        size_t bucket = 0;
+        while (us > 0 && bucket < BUCKET_COUNT - 1)
+        {
+            us >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+private:
+    std::atomic<std::uint64_t> buckets[BUCKET_COUNT];
+};
+
+}
+
+
+#endif /* PSSC_LATENCY_HISTOGRAM_H_ */
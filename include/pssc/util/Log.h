@@ -0,0 +1,82 @@
+/*
+ * Log.h
+ *
+ *  Created on: May 15, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_LOG_H_
+#define PSSC_LOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <glog/logging.h>
+
+// Logging of the message path on top of glog. Levels below PSSC_LOG_LEVEL are
+// removed at compile time, their arguments are never evaluated:
+//
+//   PSSC_LOG(TRACE) << "publish topic: " << topicId;
+//   PSSC_LOG_EVERY_MS(WARNING, 1000) << "message of unknown topic id " << topicId;
+//
+// PSSC_LOG_EVERY_MS writes at most one line per interval from each place it is
+// used, the interval has to be a constant. TRACE and DEBUG go to glog as INFO.
+
+#define PSSC_LOG_LEVEL_TRACE 0
+#define PSSC_LOG_LEVEL_DEBUG 1
+#define PSSC_LOG_LEVEL_INFO 2
+#define PSSC_LOG_LEVEL_WARNING 3
+#define PSSC_LOG_LEVEL_ERROR 4
+
+#ifndef PSSC_LOG_LEVEL
+#ifdef NDEBUG
+#define PSSC_LOG_LEVEL PSSC_LOG_LEVEL_INFO
+#else
+#define PSSC_LOG_LEVEL PSSC_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#define PSSC_LOG_SEVERITY_TRACE INFO
+#define PSSC_LOG_SEVERITY_DEBUG INFO
+#define PSSC_LOG_SEVERITY_INFO INFO
+#define PSSC_LOG_SEVERITY_WARNING WARNING
+#define PSSC_LOG_SEVERITY_ERROR ERROR
+
+#define PSSC_LOG_ENABLED(level) (PSSC_LOG_LEVEL_##level >= PSSC_LOG_LEVEL)
+
+#define PSSC_LOG(level) \
+    LOG_IF(PSSC_LOG_SEVERITY_##level, PSSC_LOG_ENABLED(level))
+
+#define PSSC_LOG_EVERY_MS(level, ms) \
+    LOG_IF(PSSC_LOG_SEVERITY_##level, PSSC_LOG_ENABLED(level) && []() \
+    { \
+        static util::LogLimiter limiter(ms); \
+        return limiter.Allow(); \
+    }())
+
+namespace util {
+
+// lets one call through per interval, from any thread
+class LogLimiter
+{
+public:
+    explicit LogLimiter(std::uint64_t intervalMs) : interval(intervalMs * 1000000), next(0) {}
+
+    inline bool Allow()
+    {
+        std::uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        std::uint64_t expected = next.load(std::memory_order_relaxed);
+        return now >= expected
+                && next.compare_exchange_strong(expected, now + interval, std::memory_order_relaxed);
+    }
+
+private:
+    std::uint64_t interval;
+    std::atomic<std::uint64_t> next;
+};
+
+}
+
+
+#endif /* PSSC_LOG_H_ */
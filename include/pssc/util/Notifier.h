@@ -13,32 +13,48 @@
 
 namespace util {
 
+// a notification sent before wait is kept, wait returns at once then.
 class Notifier
 {
     std::mutex mtx;
     std::condition_variable cv;
+    bool notified = false;
 public:
 
     template<typename Rep, typename Period>
     std::cv_status wait_for(const std::chrono::duration<Rep, Period>& time)
     {
         std::unique_lock<std::mutex> lck(mtx);
-        return cv.wait_for(lck, time);
+        if (!cv.wait_for(lck, time, [this]() { return notified; }))
+        {
+            return std::cv_status::timeout;
+        }
+        notified = false;
+        return std::cv_status::no_timeout;
     }
 
     void wait()
     {
         std::unique_lock<std::mutex> lck(mtx);
-        cv.wait(lck);
+        cv.wait(lck, [this]() { return notified; });
+        notified = false;
     }
 
     void notify_one()
     {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            notified = true;
+        }
         cv.notify_one();
     }
 
     void notify_all()
     {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            notified = true;
+        }
         cv.notify_all();
     }
 };
@@ -0,0 +1,36 @@
+/*
+ * QueueLimit.h
+ *
+ *  Created on: May 11, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_QUEUE_LIMIT_H_
+#define PSSC_QUEUE_LIMIT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// what a full queue does with one more message
+enum class QueuePolicy : std::uint8_t
+{
+    DROP_OLDEST,    // keep the latest depth messages
+    DROP_NEWEST,    // keep the queued messages, discard the new one
+};
+
+struct QueueLimit
+{
+    // 0 for no limit
+    size_t depth;
+    QueuePolicy policy;
+
+    QueueLimit(size_t depth = 0, QueuePolicy policy = QueuePolicy::DROP_OLDEST)
+        : depth(depth), policy(policy) {}
+};
+
+}
+
+
+#endif /* PSSC_QUEUE_LIMIT_H_ */
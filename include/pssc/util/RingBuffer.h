@@ -0,0 +1,131 @@
+/*
+ * RingBuffer.h
+ *
+ *  Created on: May 12, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_RING_BUFFER_H_
+#define PSSC_RING_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace util {
+
+// bounded lock-free queue for any number of producers and consumers.
+// Every cell carries a sequence number telling whether it is free for the
+// producer at a position or filled for the consumer at that position.
+template <typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity)
+        : capacity(capacity > 0 ? capacity : 1),
+          cells(new Cell[this->capacity]),
+          enqueuePos(0), dequeuePos(0)
+    {
+        for (size_t i = 0; i < this->capacity; ++i)
+        {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // false if full
+    bool TryPush(const T& value)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &cells[pos % capacity];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->seq.store(pos + 1);
+        return true;
+    }
+
+    // false if empty
+    bool TryPop(T& value)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &cells[pos % capacity];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value);
+        // do not keep what the value owns alive until the cell is reused
+        cell->value = T();
+        cell->seq.store(pos + capacity, std::memory_order_release);
+        return true;
+    }
+
+    // whether the next element to pop is not filled yet
+    bool Empty()
+    {
+        size_t pos = dequeuePos.load();
+        return cells[pos % capacity].seq.load() != pos + 1;
+    }
+
+    inline size_t Capacity() { return capacity; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    const size_t capacity;
+    std::unique_ptr<Cell[]> cells;
+    // producers and consumers do not share a cache line
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+}
+
+
+#endif /* PSSC_RING_BUFFER_H_ */
@@ -0,0 +1,185 @@
+/*
+ * Tracer.h
+ *
+ *  Created on: May 15, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_TRACER_H_
+#define PSSC_TRACER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "RingBuffer.h"
+
+namespace util {
+
+// where a message was seen on its way from the publisher to the callback
+enum class TracePoint : std::uint8_t
+{
+    PUBLISH,    // the publisher started the message
+    SEND,       // handed to the socket, by the publisher or the core
+    RECEIVE,    // read from the socket, by the core or the subscriber
+    ENQUEUE,    // queued by the core for all the subscribers
+    CALLBACK,   // the callback of the subscriber starts
+};
+
+// identifies a message in the traces of every process
+struct TraceContext
+{
+    bool traced = false;
+    std::uint64_t source = 0;
+    std::uint64_t sequence = 0;
+    std::uint32_t topic = 0;
+    // when the message was read from the socket
+    std::uint64_t receivedAt = 0;
+
+    inline void Tag(std::uint64_t source, std::uint64_t sequence, std::uint32_t topic)
+    {
+        this->traced = true;
+        this->source = source;
+        this->sequence = sequence;
+        this->topic = topic;
+    }
+};
+
+/*
+ * Timestamps of traced messages, kept in a lock-free ring of each thread and
+ * written to a file by Dump. Stamps are nanoseconds of the monotonic clock, so
+ * traces of processes on the same host can be merged. While disabled, Record
+ * returns after loading one flag.
+ */
+class Tracer
+{
+public:
+    static constexpr size_t DEFAULT_RING_CAPACITY = 64 * 1024;
+
+    struct Event
+    {
+        std::uint64_t ns;
+        std::uint64_t source;
+        std::uint64_t sequence;
+        std::uint32_t topic;
+        TracePoint point;
+    };
+
+    static Tracer& Instance()
+    {
+        // never destroyed, threads may still record at exit
+        static Tracer* tracer = new Tracer();
+        return *tracer;
+    }
+
+    static inline bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static inline std::uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // rings created from now on hold ringCapacity events, a full ring drops new ones
+    void Enable(size_t ringCapacity = DEFAULT_RING_CAPACITY)
+    {
+        this->ringCapacity = ringCapacity;
+        enabled = true;
+    }
+
+    void Disable()
+    {
+        enabled = false;
+    }
+
+    static inline void Record(TracePoint point, const TraceContext& context)
+    {
+        if (IsEnabled() && context.traced)
+        {
+            Instance().Push(point, context, Now());
+        }
+    }
+
+    static inline void Record(TracePoint point, const TraceContext& context, std::uint64_t ns)
+    {
+        if (IsEnabled() && context.traced)
+        {
+            Instance().Push(point, context, ns);
+        }
+    }
+
+    inline std::uint64_t GetDroppedEvents() { return droppedEvents; }
+
+    // moves the recorded events to the end of the file at path as CSV lines,
+    // false if it can not be written
+    bool Dump(const std::string& path)
+    {
+        auto file = fopen(path.c_str(), "a");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) == 0)
+        {
+            fprintf(file, "pid,thread,point,source,sequence,topic,ns\n");
+        }
+
+        static const char* POINT_NAMES[] = { "publish", "send", "receive", "enqueue", "callback" };
+        auto pid = getpid();
+        std::lock_guard<std::mutex> lck(mtxRings);
+        for (size_t thread = 0; thread < rings.size(); ++thread)
+        {
+            Event event;
+            while (rings[thread]->TryPop(event))
+            {
+                fprintf(file, "%d,%zu,%s,%llu,%llu,%u,%llu\n", (int)pid, thread,
+                        POINT_NAMES[static_cast<size_t>(event.point)],
+                        (unsigned long long)event.source, (unsigned long long)event.sequence,
+                        event.topic, (unsigned long long)event.ns);
+            }
+        }
+        return fclose(file) == 0;
+    }
+
+private:
+    static inline std::atomic_bool enabled { false };
+
+    std::atomic<size_t> ringCapacity;
+    std::mutex mtxRings;
+    // one ring per thread that recorded, in the order they started
+    std::vector<std::shared_ptr<RingBuffer<Event>>> rings;
+    std::atomic<std::uint64_t> droppedEvents;
+
+    Tracer() : ringCapacity(DEFAULT_RING_CAPACITY), droppedEvents(0) {}
+
+    void Push(TracePoint point, const TraceContext& context, std::uint64_t ns)
+    {
+        thread_local std::shared_ptr<RingBuffer<Event>> ring;
+        if (ring == nullptr)
+        {
+            ring = std::make_shared<RingBuffer<Event>>(ringCapacity);
+            std::lock_guard<std::mutex> lck(mtxRings);
+            rings.push_back(ring);
+        }
+
+        if (!ring->TryPush(Event { ns, context.source, context.sequence, context.topic, point }))
+        {
+            ++droppedEvents;
+        }
+    }
+};
+
+}
+
+
+#endif /* PSSC_TRACER_H_ */
@@ -0,0 +1,125 @@
+/*
+ * BenchUtil.h
+ *
+ *  Created on: May 14, 2021
+ *      Author: ubuntu
+ */
+
+#ifndef PSSC_BENCH_UTIL_H_
+#define PSSC_BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+namespace bench {
+
+// nanoseconds of the monotonic clock, comparable between processes of a host
+inline std::uint64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// user and system time of the process in microseconds
+inline double CpuTimeUs()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// value of --name=value, or def
+inline std::string GetOption(int argc, char* argv[], const std::string& name, const std::string& def)
+{
+    std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, prefix.size(), prefix) == 0)
+        {
+            return arg.substr(prefix.size());
+        }
+    }
+    return def;
+}
+
+inline bool HasFlag(int argc, char* argv[], const std::string& name)
+{
+    std::string flag = "--" + name;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (flag == argv[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// "1,2,3" -> { 1, 2, 3 }
+inline std::vector<size_t> ParseList(const std::string& list)
+{
+    std::vector<size_t> values;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            values.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        }
+    }
+    return values;
+}
+
+// latencies in nanoseconds, summarized in microseconds
+class Histogram
+{
+    std::vector<std::uint64_t> samples;
+    bool sorted = true;
+
+public:
+    inline void Reserve(size_t count) { samples.reserve(count); }
+
+    inline void Add(std::uint64_t ns)
+    {
+        samples.push_back(ns);
+        sorted = false;
+    }
+
+    void Merge(const Histogram& other)
+    {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+        sorted = false;
+    }
+
+    inline size_t Count() const { return samples.size(); }
+
+    // p in [0, 1], 0 without samples
+    double PercentileUs(double p)
+    {
+        if (samples.empty())
+        {
+            return 0;
+        }
+        if (!sorted)
+        {
+            std::sort(samples.begin(), samples.end());
+            sorted = true;
+        }
+        size_t index = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+        return samples[index] / 1e3;
+    }
+};
+
+}
+
+
+#endif /* PSSC_BENCH_UTIL_H_ */
@@ -0,0 +1,142 @@
+/*
+ * bench_call.cpp
+ *
+ *  Created on: May 14, 2021
+ *      Author: ubuntu
+ */
+
+// Service call round trips. Every combination of concurrent callers, request size
+// and response size is one case, reported as a CSV line:
+//
+//   bench_call [--callers=1,4,16] [--request-sizes=64,4096] [--response-sizes=64,4096]
+//              [--calls=2000] [--port=23501] [--core-threads=2] [--external-core]
+//              [--server-threads=1] [--server-concurrency=1]
+//
+// Each caller is a node of its own calling RemoteCall in a loop, calls are split
+// evenly among them. The service node answers every call at once with a payload
+// of the response size, the way test_service does.
+
+#include "pssc/pssc.h"
+#include "pssc/protocol/Node.h"
+#include "BenchUtil.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+const char* SERVICE_NAME = "bench_call";
+
+// response size of the current case, read by the service callback
+std::atomic<size_t> responseSize(0);
+
+void RunCase(std::vector<pssc::Node*>& callers, size_t callerCount,
+        size_t requestSize, size_t respSize, size_t calls)
+{
+    responseSize = respSize;
+    size_t callsPerCaller = std::max<size_t>(1, calls / callerCount);
+
+    std::vector<bench::Histogram> latencies(callerCount);
+    std::vector<size_t> succeeded(callerCount, 0);
+    std::vector<std::thread> threads;
+
+    auto cpuStart = bench::CpuTimeUs();
+    auto start = bench::NowNs();
+    for (size_t i = 0; i < callerCount; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            std::vector<std::uint8_t> request(requestSize);
+            latencies[i].Reserve(callsPerCaller);
+            for (size_t n = 0; n < callsPerCaller; ++n)
+            {
+                auto sentAt = bench::NowNs();
+                auto resp = callers[i]->RemoteCall(SERVICE_NAME, request.data(), request.size());
+                latencies[i].Add(bench::NowNs() - sentAt);
+                succeeded[i] += resp->success ? 1 : 0;
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    double elapsed = (bench::NowNs() - start) / 1e9;
+    double cpu = bench::CpuTimeUs() - cpuStart;
+
+    bench::Histogram all;
+    size_t total = 0;
+    for (size_t i = 0; i < callerCount; ++i)
+    {
+        all.Merge(latencies[i]);
+        total += succeeded[i];
+    }
+
+    printf("%zu,%zu,%zu,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.0f,%.2f\n",
+            callerCount, requestSize, respSize, callsPerCaller * callerCount, total,
+            all.PercentileUs(0.5), all.PercentileUs(0.99),
+            all.PercentileUs(0.999), all.PercentileUs(1.0),
+            all.Count() / elapsed, all.Count() > 0 ? cpu / all.Count() : 0.0);
+    fflush(stdout);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    auto callerCounts = bench::ParseList(bench::GetOption(argc, argv, "callers", "1,4,16"));
+    auto requestSizes = bench::ParseList(bench::GetOption(argc, argv, "request-sizes", "64,4096"));
+    auto responseSizes = bench::ParseList(bench::GetOption(argc, argv, "response-sizes", "64,4096"));
+    size_t calls = std::stoul(bench::GetOption(argc, argv, "calls", "2000"));
+    int port = std::stoi(bench::GetOption(argc, argv, "port", "23501"));
+    size_t coreThreads = std::stoul(bench::GetOption(argc, argv, "core-threads", "2"));
+
+    if (!bench::HasFlag(argc, argv, "external-core"))
+    {
+        // never destroyed, the process exits with it running
+        auto core = new pssc::Core(port, coreThreads);
+        std::thread([core]() { core->Start(); }).detach();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    pssc::Node server;
+    server.SetExecutorThreads(std::stoul(bench::GetOption(argc, argv, "server-threads", "1")));
+    server.SetServiceConcurrency(std::stoul(bench::GetOption(argc, argv, "server-concurrency", "1")));
+    std::vector<std::uint8_t> response(*std::max_element(responseSizes.begin(), responseSizes.end()));
+    server.SetServiceCallback([&response](std::string, std::uint8_t*, size_t,
+            std::shared_ptr<pssc::Node::ResponseOperator> op)
+    {
+        op->SendResponse(true, response.data(), responseSize);
+    });
+    if (!server.Initialize(port) || !server.AdvertiseService(SERVICE_NAME))
+    {
+        fprintf(stderr, "failed to advertise the service on the core on port %d.\n", port);
+        return 1;
+    }
+
+    size_t maxCallers = *std::max_element(callerCounts.begin(), callerCounts.end());
+    std::vector<pssc::Node*> callers;
+    for (size_t i = 0; i < maxCallers; ++i)
+    {
+        auto node = new pssc::Node();
+        node->Initialize(port);
+        callers.push_back(node);
+    }
+
+    printf("callers,request_size,response_size,calls,succeeded,p50_us,p99_us,p999_us,max_us,calls_per_s,cpu_us_per_call\n");
+    for (auto callerCount : callerCounts)
+    {
+        for (auto requestSize : requestSizes)
+        {
+            for (auto respSize : responseSizes)
+            {
+                RunCase(callers, callerCount, requestSize, respSize, calls);
+            }
+        }
+    }
+
+    // the io threads of the nodes and the core are still running
+    _exit(0);
+}
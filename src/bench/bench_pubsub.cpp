@@ -0,0 +1,213 @@
+/*
+ * bench_pubsub.cpp
+ *
+ *  Created on: May 14, 2021
+ *      Author: ubuntu
+ */
+
+// Publish/subscribe latency and throughput. Every combination of payload size,
+// publish rate and subscriber count is one case, reported as a CSV line:
+//
+//   bench_pubsub [--sizes=64,1024,16384,262144] [--rates=0,1000] [--subscribers=1,4]
+//                [--count=2000] [--port=23500] [--core-threads=2] [--external-core]
+//                [--direct] [--shm-threshold=0] [--trace=FILE]
+//
+// A rate of 0 publishes as fast as possible. --direct and --shm-threshold set
+// SetDirectPublish and SetSharedMemoryThreshold of the publisher. The core runs
+// in this process unless --external-core is given, then a core must be listening
+// on --port and its cpu time is not counted in cpu_us_per_msg. --trace appends the
+// timestamps of every message at each step of its way to FILE.
+
+#include "pssc/pssc.h"
+#include "pssc/protocol/Node.h"
+#include "BenchUtil.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// what one subscriber received in a case
+struct Recorder
+{
+    std::mutex mtx;
+    bench::Histogram latencies;
+    std::atomic<size_t> received;
+    std::atomic<std::uint64_t> lastReceivedAt;
+
+    Recorder() : received(0), lastReceivedAt(0) {}
+
+    void OnMessage(std::uint8_t* data, size_t)
+    {
+        auto now = bench::NowNs();
+        std::uint64_t sentAt;
+        memcpy(&sentAt, data, sizeof(sentAt));
+
+        std::lock_guard<std::mutex> lck(mtx);
+        latencies.Add(now - sentAt);
+        lastReceivedAt = now;
+        ++received;
+    }
+};
+
+size_t Received(std::vector<std::shared_ptr<Recorder>>& recorders)
+{
+    size_t received = 0;
+    for (auto& recorder : recorders)
+    {
+        received += recorder->received;
+    }
+    return received;
+}
+
+void RunCase(pssc::Node& publisher, std::vector<pssc::Node*>& subscribers, size_t caseId,
+        size_t size, size_t rate, size_t subscriberCount, size_t count)
+{
+    std::string topic = "bench_pubsub_" + std::to_string(caseId);
+    std::vector<std::shared_ptr<Recorder>> recorders;
+    for (size_t i = 0; i < subscriberCount; ++i)
+    {
+        auto recorder = std::make_shared<Recorder>();
+        recorder->latencies.Reserve(count);
+        recorders.push_back(recorder);
+        subscribers[i]->Subscribe(topic, [recorder](std::uint8_t* data, size_t size)
+        {
+            recorder->OnMessage(data, size);
+        });
+    }
+    // the topic id and the subscribers are not looked up while timing
+    publisher.AdvertiseTopic(topic);
+
+    std::vector<std::uint8_t> payload(size);
+    auto period = rate > 0 ? std::chrono::nanoseconds(1000000000ull / rate) : std::chrono::nanoseconds(0);
+    auto cpuStart = bench::CpuTimeUs();
+    auto startNs = bench::NowNs();
+    auto next = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (rate > 0)
+        {
+            std::this_thread::sleep_until(next);
+            next += period;
+        }
+        auto now = bench::NowNs();
+        memcpy(payload.data(), &now, sizeof(now));
+        publisher.Publish(topic, payload.data(), payload.size());
+    }
+
+    // until everything arrived, or nothing more arrives for a second
+    size_t expected = count * subscriberCount;
+    size_t received = Received(recorders);
+    auto lastProgress = std::chrono::steady_clock::now();
+    while (received < expected && std::chrono::steady_clock::now() - lastProgress < std::chrono::seconds(1))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto current = Received(recorders);
+        if (current != received)
+        {
+            received = current;
+            lastProgress = std::chrono::steady_clock::now();
+        }
+    }
+    double cpu = bench::CpuTimeUs() - cpuStart;
+    std::uint64_t endNs = startNs + 1;
+    for (auto& recorder : recorders)
+    {
+        endNs = std::max<std::uint64_t>(endNs, recorder->lastReceivedAt);
+    }
+    double elapsed = (endNs - startNs) / 1e9;
+
+    for (size_t i = 0; i < subscriberCount; ++i)
+    {
+        subscribers[i]->UnSubscribe(topic);
+    }
+
+    bench::Histogram latencies;
+    for (auto& recorder : recorders)
+    {
+        std::lock_guard<std::mutex> lck(recorder->mtx);
+        latencies.Merge(recorder->latencies);
+    }
+
+    printf("%zu,%zu,%zu,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.0f,%.2f,%.2f\n",
+            size, rate, subscriberCount, count, received,
+            latencies.PercentileUs(0.5), latencies.PercentileUs(0.99),
+            latencies.PercentileUs(0.999), latencies.PercentileUs(1.0),
+            received / elapsed, received * size / elapsed / 1e6,
+            received > 0 ? cpu / received : 0.0);
+    fflush(stdout);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    auto sizes = bench::ParseList(bench::GetOption(argc, argv, "sizes", "64,1024,16384,262144"));
+    auto rates = bench::ParseList(bench::GetOption(argc, argv, "rates", "0,1000"));
+    auto subscriberCounts = bench::ParseList(bench::GetOption(argc, argv, "subscribers", "1,4"));
+    size_t count = std::stoul(bench::GetOption(argc, argv, "count", "2000"));
+    int port = std::stoi(bench::GetOption(argc, argv, "port", "23500"));
+    size_t coreThreads = std::stoul(bench::GetOption(argc, argv, "core-threads", "2"));
+    auto tracePath = bench::GetOption(argc, argv, "trace", "");
+    if (!tracePath.empty())
+    {
+        util::Tracer::Instance().Enable();
+    }
+
+    if (!bench::HasFlag(argc, argv, "external-core"))
+    {
+        // never destroyed, the process exits with it running
+        auto core = new pssc::Core(port, coreThreads);
+        std::thread([core]() { core->Start(); }).detach();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    pssc::Node publisher;
+    publisher.SetDirectPublish(bench::HasFlag(argc, argv, "direct"));
+    publisher.SetSharedMemoryThreshold(std::stoul(bench::GetOption(argc, argv, "shm-threshold", "0")));
+    if (!publisher.Initialize(port))
+    {
+        fprintf(stderr, "failed to connect to the core on port %d.\n", port);
+        return 1;
+    }
+
+    size_t maxSubscribers = *std::max_element(subscriberCounts.begin(), subscriberCounts.end());
+    std::vector<pssc::Node*> subscribers;
+    for (size_t i = 0; i < maxSubscribers; ++i)
+    {
+        auto node = new pssc::Node();
+        node->Initialize(port);
+        subscribers.push_back(node);
+    }
+
+    printf("size,rate,subscribers,sent,received,p50_us,p99_us,p999_us,max_us,msgs_per_s,mb_per_s,cpu_us_per_msg\n");
+    size_t caseId = 0;
+    for (auto size : sizes)
+    {
+        for (auto rate : rates)
+        {
+            for (auto subscriberCount : subscriberCounts)
+            {
+                RunCase(publisher, subscribers, caseId++, std::max(size, sizeof(std::uint64_t)),
+                        rate, subscriberCount, count);
+                if (!tracePath.empty() && !util::Tracer::Instance().Dump(tracePath))
+                {
+                    fprintf(stderr, "failed to write the trace to %s.\n", tracePath.c_str());
+                }
+            }
+        }
+    }
+
+    if (util::Tracer::Instance().GetDroppedEvents() > 0)
+    {
+        fprintf(stderr, "%llu trace events dropped by full rings.\n",
+                (unsigned long long)util::Tracer::Instance().GetDroppedEvents());
+    }
+
+    // the io threads of the nodes and the core are still running
+    _exit(0);
+}
@@ -8,21 +8,28 @@
 #include "pssc/protocol/Core.h"
 #include "pssc/protocol/Instruction.h"
 #include <glog/logging.h>
+#include "pssc/util/Log.h"
+#include <algorithm>
+#include <chrono>
 #include <thread>
 #include <string>
-#include <future>
+#include <vector>
 #include "pssc/protocol/msgs/pssc_msgs.h"
 
 namespace pssc
 {
 
-Core::Core(int port)
+Core::Core(int port, size_t threadCount)
+    : maxQueuedBytes(TCPConnection::DEFAULT_MAX_QUEUED_BYTES), srvBalancing(ServiceBalancing::ROUND_ROBIN)
 {
     server = std::make_unique<TCPServer>(
             port,
             std::bind(&Core::OnConnected, this, std::placeholders::_1),
-            std::bind(&Core::OnDisconnected, this, std::placeholders::_1)
+            std::bind(&Core::OnDisconnected, this, std::placeholders::_1),
+            TCPServer::DEFAULT_MAX_CONNECTIONS,
+            threadCount
     );
+    routes = std::make_shared<const RoutingTable>();
 }
 
 void Core::OnConnected(std::shared_ptr<TCPConnection> conn)
@@ -32,6 +39,7 @@ void Core::OnConnected(std::shared_ptr<TCPConnection> conn)
     conn->SetOnMessage(
         std::bind(&Core::DispatchMessage, this, conn, std::placeholders::_1)
     );
+    conn->SetMaxQueuedBytes(maxQueuedBytes);
 
     conn->Start();
 }
@@ -39,31 +47,83 @@ void Core::OnConnected(std::shared_ptr<TCPConnection> conn)
 void Core::OnDisconnected(std::shared_ptr<TCPConnection> conn)
 {
     // remove name->connection
-    for (auto & node : nodes)
+    pssc_id nodeId;
     {
-        if (node.second.get() == conn.get())
+        pssc_write_guard guard(rwlckNodes);
+        auto node = nodes.begin();
+        for (; node != nodes.end(); ++node)
         {
-            DLOG(INFO) << "node with id " << node.first << " was disconnected.";
-            auto nodeId = node.first;
-            nodes.erase(nodeId);
-
-            // close service
-            pssc_write_guard guard(rwlckSrvs);
-            std::list<std::string> srv_names;
-            for(auto srv : srvs)
+            if (node->second.get() == conn.get())
             {
-                if (srv.second == nodeId)
+                break;
+            }
+        }
+
+        if (node == nodes.end())
+        {
+            return;
+        }
+
+        DLOG(INFO) << "node with id " << node->first << " was disconnected.";
+        nodeId = node->first;
+        nodes.erase(nodeId);
+        endpoints.erase(nodeId);
+    }
+
+    {
+        // close service
+        pssc_write_guard guard(rwlckSrvs);
+        for (auto srv = srvs.begin(); srv != srvs.end();)
+        {
+            auto& providers = srv->second.providers;
+            providers.erase(std::remove_if(providers.begin(), providers.end(),
+                    [nodeId](const std::shared_ptr<ServiceProvider>& provider)
+                    {
+                        return provider->nodeId == nodeId;
+                    }), providers.end());
+            srv = providers.empty() ? srvs.erase(srv) : std::next(srv);
+        }
+    }
+
+    {
+        // calls the node will not respond to
+        std::list<std::pair<pssc_id, pssc_id>> lost;
+        {
+            std::lock_guard<std::mutex> lck(mtxCalls);
+            for (auto call = calls.begin(); call != calls.end();)
+            {
+                if (call->second->nodeId == nodeId)
                 {
-                    srv_names.push_back(srv.first);
+                    lost.push_back(call->first);
+                    call = calls.erase(call);
+                }
+                else
+                {
+                    ++call;
                 }
             }
+        }
+
+        for (auto& call : lost)
+        {
+            FailCall(call.first, call.second);
+        }
+    }
 
-            for(auto srv_name : srv_names)
+    {
+        // remove subscriptions and advertisements
+        pssc_write_guard guard(rwlckTopics);
+        for (auto& topic : topics)
+        {
+            auto& subscribers = topic.subscribers;
+            if (std::find(subscribers.begin(), subscribers.end(), nodeId) != subscribers.end())
             {
-                srvs.erase(srv_name);
+                subscribers.remove(nodeId);
+                topic.limits.erase(nodeId);
+                UpdateRoute(topic);
+                NotifyAdvertisers(topic);
             }
-
-            return;
+            topic.advertisers.remove(nodeId);
         }
     }
 }
@@ -72,6 +132,7 @@ void Core::DispatchMessage(std::shared_ptr<TCPConnection> conn, std::shared_ptr<
 {
     if (conn->IsRunning())
     {
+        auto start = std::chrono::steady_clock::now();
         pssc_ins ins;
         msg->NextData(ins);
 
@@ -83,6 +144,12 @@ void Core::DispatchMessage(std::shared_ptr<TCPConnection> conn, std::shared_ptr<
                 break;
             }
 
+            case Ins::QUERY_METRICS:
+            {
+                QueryMetrics(conn, msg);
+                break;
+            }
+
             case Ins::QUERY_SUBSCRIBER_NUMBER:
             {
                 QuerySubNum(conn, msg);
@@ -90,6 +157,7 @@ void Core::DispatchMessage(std::shared_ptr<TCPConnection> conn, std::shared_ptr<
             }
 
             case Ins::PUBLISH:
+            case Ins::SHM_PUBLISH:
             {
                 Publish(conn, msg);
                 break;
@@ -131,12 +199,22 @@ void Core::DispatchMessage(std::shared_ptr<TCPConnection> conn, std::shared_ptr<
                 break;
             }
 
+            case Ins::ADVERTISE_TOPIC:
+            {
+                AdvertiseTopic(conn, msg);
+                break;
+            }
+
             default:
             {
                 DLOG(ERROR) << "UNKOWN MESSAGE";
                 break;
             }
         }
+
+        dispatchLatencies[std::min<pssc_ins>(ins, Ins::UNKOWN)].Record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count());
     }
 }
 
@@ -156,6 +234,7 @@ void Core::Register(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMess
     else
     {
         nodes.insert(std::make_pair(ack.nodeId, conn));
+        endpoints.insert(std::make_pair(ack.nodeId, PeerEndpoint { conn->GetRemoteAddress(), req.peerPort }));
         ack.success = true;
     }
 
@@ -169,80 +248,73 @@ void Core::QuerySubNum(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPM
     DLOG(WARNING) << "QUERY_SUBSCRIBER_NUMBER: inquirerId:" << req.inquirerId;
 
     pssc_read_guard guardTopics(rwlckTopics);
-    auto&& subscribers = topics.find(req.topic);
+    auto topic = FindTopic(req.topic);
 
     QuerySubNumACKMessage resp;
     resp.messageId = req.messageId;
-    resp.subNum = ((subscribers == topics.end()) ? (0) : (subscribers->second.size()));
+    resp.subNum = ((topic == nullptr) ? (0) : (topic->subscribers.size()));
 
     conn->PendMessage(resp.toTCPMessage());
     DLOG(INFO) << "QUERY_SUBSCRIBER_NUMBER Responsed with subNum:" << resp.subNum;
 }
 
-void Core::Publish(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
+void Core::Publish(std::shared_ptr<TCPConnection>, std::shared_ptr<TCPMessage> msg)
 {
     PublishMessage req(msg);
-    DLOG(WARNING) << "PUBLISH: publisher id:" << req.publisherId;
-
-    pssc_read_guard guardTopics(rwlckTopics);
-    auto&& subscribers = topics.find(req.topic);
-    DLOG(WARNING) << "publish data size: " << req.sizeOfData;
+    PSSC_LOG(TRACE) << "PUBLISH: publisher id:" << req.publisherId << ", data size: " << req.sizeOfData;
 
-    if (subscribers == topics.end())
+    // the route holds the connections of the subscribers already,
+    // no lock or lookup of nodes is needed to fan out.
+    auto table = std::atomic_load(&routes);
+    if (req.topicId == 0 || req.topicId > table->size() || (*table)[req.topicId - 1] == nullptr)
     {
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "publish to unknown topic id: " << req.topicId;
         return;
     }
 
-    if (subscribers->second.size() > 1)
+    if (util::Tracer::IsEnabled())
     {
-        std::vector<std::future<bool>> fs;
-        for (auto& subscriberId : subscribers->second)
+        msg->trace.Tag(req.publisherId, req.messageId, req.topicId);
+        util::Tracer::Record(util::TracePoint::RECEIVE, msg->trace,
+                msg->trace.receivedAt != 0 ? msg->trace.receivedAt : util::Tracer::Now());
+    }
+
+    auto& route = *(*table)[req.topicId - 1];
+    auto& stats = *route.stats;
+    auto bytes = msg->header.bodyLength;
+    stats.messagesIn.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+
+    // a node publishing directly reached the subscribers accepting peers already
+    bool peerless = req.relay == PublishMessage::RELAY_PEERLESS;
+
+    std::uint64_t queued = 0;
+    std::uint64_t dropped = 0;
+    for (auto& entry : route.entries)
+    {
+        if ((entry.nodeId == req.publisherId && !req.feedback) || (peerless && entry.direct))
         {
-            if (subscriberId == req.publisherId && !req.feedback)
-            {
-                continue;
-            }
-            DLOG(WARNING) << "publish topic: " + req.topic + " to node with id: " << subscriberId;
-            pssc_read_guard guardNodes(rwlckNodes);
-            try {
-                auto& subConn = nodes.at(subscriberId);
-
-                auto f = std::async([subConn, msg](){
-                    subConn->PendMessage(msg);
-                    return true;
-                });
-                fs.emplace_back(std::move(f));
-            } catch (...) {
-                // disconnected subscriber, do nothing
-                std::this_thread::yield();
-            }
+            continue;
         }
-
-        for (auto& f :  fs)
+        PSSC_LOG(TRACE) << "publish topic: " << req.topicId << " to node with id: " << entry.nodeId;
+        ++queued;
+        if (!entry.conn->PendMessage(msg, req.topicId, entry.limit))
         {
-            f.get();
+            ++dropped;
         }
     }
-    else
-    {
-        for (auto& subscriberId : subscribers->second)
-        {
-            if (subscriberId == req.publisherId && !req.feedback)
-            {
-                continue;
-            }
-            DLOG(WARNING) << "publish topic: " + req.topic + " to node with id: " << subscriberId;
-            pssc_read_guard guardNodes(rwlckNodes);
-            try {
-                auto& subConn = nodes.at(subscriberId);
 
-                subConn->PendMessage(msg);
+    util::Tracer::Record(util::TracePoint::ENQUEUE, msg->trace);
 
-            } catch (...) {
-                // disconnected subscriber, do nothing
-                std::this_thread::yield();
-            }
-        }
+    // a message dropped for another of the topic takes its place in the count
+    if (queued > dropped)
+    {
+        stats.messagesOut.fetch_add(queued - dropped, std::memory_order_relaxed);
+        stats.bytesOut.fetch_add((queued - dropped) * bytes, std::memory_order_relaxed);
+    }
+    if (dropped > 0)
+    {
+        stats.dropped.fetch_add(dropped, std::memory_order_relaxed);
     }
 }
 
@@ -254,35 +326,29 @@ void Core::Subscribe(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMes
     DLOG(INFO) << "SUBSCRIBE: " << req.subscriberId << "," << req.topic;
 
     pssc_write_guard guard(rwlckTopics);
-    if (topics.find(req.topic) == topics.end())
-    {
-        std::list<pssc_id> subscribers;
-        subscribers.emplace_back(req.subscriberId);
-        topics.insert(std::make_pair(req.topic, subscribers));
+    auto& topic = topics[InternTopic(req.topic) - 1];
+    resp.success = true;
+    resp.topicId = topic.id;
+    resp.messageId = req.messageId;
 
-        resp.success = true;
+    // the ack goes before any message of the topic, so the node knows the id
+    conn->PendMessage(resp.toTCPMessage());
+    DLOG(INFO) << "SUBSCRIBE response: " << req.subscriberId << "," << resp.success;
+
+    // subscribing again only changes the limit
+    topic.limits[req.subscriberId] = req.limit;
+    auto& subscribers = topic.subscribers;
+    if (std::find(subscribers.begin(), subscribers.end(), req.subscriberId) == subscribers.end())
+    {
+        subscribers.push_back(req.subscriberId);
+        DLOG(INFO) << "SUBSCRIBE: OK, count of subscriber:" << subscribers.size();
+        UpdateRoute(topic);
+        NotifyAdvertisers(topic);
     }
     else
     {
-        try {
-            auto& subscribers = topics.at(req.topic);
-            if (std::find(subscribers.begin(), subscribers.end(), req.subscriberId) == subscribers.end())
-            {
-                subscribers.push_back(req.subscriberId);
-                DLOG(INFO) << "SUBSCRIBE: OK, count of subscriber:" << subscribers.size();
-                resp.success = true;
-            }
-        }
-        catch (...)
-        {
-            DLOG(ERROR) << "SUBSCRIBE: ???";
-            resp.success = false;
-        }
+        UpdateRoute(topic);
     }
-
-    resp.messageId = req.messageId;
-    conn->PendMessage(resp.toTCPMessage());
-    DLOG(INFO) << "SUBSCRIBE response: " << req.subscriberId << "," << resp.success;
 }
 
 void Core::UnSubscribe(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
@@ -293,32 +359,16 @@ void Core::UnSubscribe(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPM
     DLOG(INFO) << "UNSUBSCRIBE: " << req.subscriberId << "," << req.topic;
 
     pssc_write_guard guard(rwlckTopics);
-    if (topics.find(req.topic) == topics.end())
-    {
-        resp.success = true;
-    }
-    else
+    auto topic = FindTopic(req.topic);
+    if (topic != nullptr)
     {
-        try {
-            auto& subscribers = topics.at(req.topic);
-//            auto subscriber = std::find(subscribers.begin(), subscribers.end(), req.subscriberId);
-//            if (subscriber != subscribers.end())
-//            {
-//                subscribers.erase(subscriber);
-//                DLOG(INFO) << "UNSUBSCRIBE: OK, count of subscriber:" << subscribers.size();
-//            }
-
-            subscribers.remove(req.subscriberId);
-            DLOG(INFO) << "UNSUBSCRIBE: OK, count of subscriber:" << subscribers.size();
-
-            resp.success = true;
-        }
-        catch (...)
-        {
-            DLOG(ERROR) << "UNSUBSCRIBE: ???";
-            resp.success = false;
-        }
+        topic->subscribers.remove(req.subscriberId);
+        topic->limits.erase(req.subscriberId);
+        DLOG(INFO) << "UNSUBSCRIBE: OK, count of subscriber:" << topic->subscribers.size();
+        UpdateRoute(*topic);
+        NotifyAdvertisers(*topic);
     }
+    resp.success = true;
 
     resp.messageId = req.messageId;
     conn->PendMessage(resp.toTCPMessage());
@@ -335,7 +385,12 @@ void Core::AdvertiseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr
     DLOG(INFO) << "ADVERTISE SERVICE: " << req.advertiserId << "," << req.srv_name;
 
     pssc_write_guard guard(rwlckSrvs);
-    if (srvs.find(req.srv_name) != srvs.end())
+    auto& providers = srvs[req.srv_name].providers;
+    if (std::find_if(providers.begin(), providers.end(),
+            [&req](const std::shared_ptr<ServiceProvider>& provider)
+            {
+                return provider->nodeId == req.advertiserId;
+            }) != providers.end())
     {
         ack.success = false;
 
@@ -344,7 +399,8 @@ void Core::AdvertiseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr
     }
     else
     {
-        srvs.insert(std::make_pair(req.srv_name, req.advertiserId));
+        // several nodes may provide a service, the calls are spread among them
+        providers.push_back(std::make_shared<ServiceProvider>(req.advertiserId));
         ack.success = true;
 
         conn->PendMessage(ack.toTCPMessage());
@@ -353,51 +409,163 @@ void Core::AdvertiseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr
     }
 }
 
+std::shared_ptr<Core::ServiceProvider> Core::ChooseProvider(Service& srv, pssc_id callerId)
+{
+    auto& providers = srv.providers;
+    switch (srvBalancing)
+    {
+        case ServiceBalancing::LEAST_OUTSTANDING:
+        {
+            return *std::min_element(providers.begin(), providers.end(),
+                    [](const std::shared_ptr<ServiceProvider>& a, const std::shared_ptr<ServiceProvider>& b)
+                    {
+                        return a->outstanding < b->outstanding;
+                    });
+        }
+
+        case ServiceBalancing::CALLER_HASH:
+        {
+            // rendezvous hashing, only the callers of a provider leaving move
+            std::shared_ptr<ServiceProvider> chosen;
+            std::uint64_t best = 0;
+            for (auto& provider : providers)
+            {
+                std::uint64_t weight = callerId * 0x9E3779B97F4A7C15ull ^ provider->nodeId;
+                weight ^= weight >> 29;
+                weight *= 0xBF58476D1CE4E5B9ull;
+                weight ^= weight >> 32;
+                if (chosen == nullptr || weight > best)
+                {
+                    chosen = provider;
+                    best = weight;
+                }
+            }
+            return chosen;
+        }
+
+        case ServiceBalancing::ROUND_ROBIN:
+        default:
+        {
+            return providers[srv.next++ % providers.size()];
+        }
+    }
+}
+
+void Core::FailCall(pssc_id callerId, pssc_id messageId)
+{
+    ServiceResponseMessage resp;
+    resp.messageId = messageId;
+    resp.callerId = callerId;
+    resp.success = false;
+
+    pssc_read_guard guard(rwlckNodes);
+    auto caller = nodes.find(callerId);
+    if (caller != nodes.end())
+    {
+        caller->second->PendMessage(resp.toTCPMessage(), TCPConnection::Priority::SERVICE);
+    }
+}
 
 void Core::CallService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
 {
     ServiceCallMessage req(msg);
 
-    DLOG(INFO) << "CALL SERVICE: callerId:" << req.callerId
+    PSSC_LOG(TRACE) << "CALL SERVICE: callerId:" << req.callerId
             << ", messageId:" << req.messageId
             << ", srv_name:" << req.srv_name;
 
-    pssc_read_guard guard(rwlckSrvs);
-    auto fd = srvs.find(req.srv_name);
-    if (fd == srvs.end())
+    std::shared_ptr<ServiceProvider> provider;
+    {
+        pssc_read_guard guard(rwlckSrvs);
+        auto fd = srvs.find(req.srv_name);
+        if (fd != srvs.end() && !fd->second.providers.empty())
+        {
+            provider = ChooseProvider(fd->second, req.callerId);
+        }
+    }
+
+    if (provider == nullptr)
     {
         ServiceResponseMessage resp;
         resp.messageId = req.messageId;
         resp.success = false;
-        conn->PendMessage(resp.toTCPMessage());
-        DLOG(INFO) << "NOT DONE.";
+        conn->PendMessage(resp.toTCPMessage(), TCPConnection::Priority::SERVICE);
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "call of service " << req.srv_name << " failed, no node provides it.";
+        return;
     }
-    else
+
+    // recorded before the provider is looked up, so either its disconnection
+    // fails the call or the lookup below does
+    auto key = std::make_pair(req.callerId, req.messageId);
+    {
+        std::lock_guard<std::mutex> lck(mtxCalls);
+        calls[key] = provider;
+        ++provider->outstanding;
+    }
+
+    std::shared_ptr<TCPConnection> srv_conn;
     {
-        try {
-            auto srv_conn =  nodes.at(fd->second);
-            srv_conn->PendMessage(msg);
-            DLOG(INFO) << "DONE.";
-        } catch (...) {
-            ServiceResponseMessage resp;
-            resp.messageId = req.messageId;
-            resp.success = false;
-            conn->PendMessage(resp.toTCPMessage());
-
-            DLOG(INFO) << "NOT DONE: Closed.";
+        pssc_read_guard guard(rwlckNodes);
+        auto fd = nodes.find(provider->nodeId);
+        if (fd != nodes.end())
+        {
+            srv_conn = fd->second;
         }
     }
+
+    if (srv_conn == nullptr)
+    {
+        bool pending;
+        {
+            std::lock_guard<std::mutex> lck(mtxCalls);
+            pending = calls.erase(key) > 0;
+            if (pending)
+            {
+                --provider->outstanding;
+            }
+        }
+        if (pending)
+        {
+            FailCall(req.callerId, req.messageId);
+        }
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "call of service " << req.srv_name << " failed, its provider has gone.";
+        return;
+    }
+
+    srv_conn->PendMessage(msg, TCPConnection::Priority::SERVICE);
+    PSSC_LOG(TRACE) << "DONE.";
 }
 
-void Core::ResponseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
+void Core::ResponseService(std::shared_ptr<TCPConnection>, std::shared_ptr<TCPMessage> msg)
 {
     ServiceResponseMessage req(msg);
 
-    DLOG(INFO) << "RESPONSE SERVICE: clientId:" << req.callerId
+    PSSC_LOG(TRACE) << "RESPONSE SERVICE: clientId:" << req.callerId
                 << ", messageId:" << req.messageId;
-    auto srv_conn =  nodes.at(req.callerId);
 
-    srv_conn->PendMessage(msg);
+    {
+        std::lock_guard<std::mutex> lck(mtxCalls);
+        auto call = calls.find(std::make_pair(req.callerId, req.messageId));
+        if (call == calls.end())
+        {
+            // failed already, its provider has gone
+            PSSC_LOG(DEBUG) << "NOT DONE: Failed.";
+            return;
+        }
+        --call->second->outstanding;
+        calls.erase(call);
+    }
+
+    pssc_read_guard guard(rwlckNodes);
+    auto srv_conn = nodes.find(req.callerId);
+    if (srv_conn == nodes.end())
+    {
+        // the caller has gone
+        PSSC_LOG(DEBUG) << "NOT DONE: Closed.";
+        return;
+    }
+
+    srv_conn->second->PendMessage(msg, TCPConnection::Priority::SERVICE);
 }
 
 void Core::CloseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
@@ -412,21 +580,214 @@ void Core::CloseService(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCP
 
     pssc_write_guard guard(rwlckSrvs);
     auto fd = srvs.find(req.srv_name);
-    if (fd == srvs.end() || fd->second != req.advertiserId)
+    if (fd == srvs.end())
     {
         resp.success = false;
         DLOG(INFO) << "NOT DONE.";
     }
     else
     {
-        srvs.erase(fd);
-        resp.success = true;
-        DLOG(INFO) << "DONE.";
+        // calls sent to the node already are still responded by it
+        auto& providers = fd->second.providers;
+        auto provider = std::find_if(providers.begin(), providers.end(),
+                [&req](const std::shared_ptr<ServiceProvider>& provider)
+                {
+                    return provider->nodeId == req.advertiserId;
+                });
+        resp.success = provider != providers.end();
+        if (resp.success)
+        {
+            providers.erase(provider);
+            if (providers.empty())
+            {
+                srvs.erase(fd);
+            }
+        }
+        DLOG(INFO) << (resp.success ? "DONE." : "NOT DONE.");
+    }
+
+    conn->PendMessage(resp.toTCPMessage());
+}
+
+void Core::AdvertiseTopic(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
+{
+    AdvertiseTopicMessage req(msg);
+    TopicSubscribersMessage resp(Ins::ADVTOPICACK);
+    resp.messageId = req.messageId;
+
+    DLOG(INFO) << "ADVERTISE TOPIC: " << req.advertiserId << "," << req.topic;
+
+    pssc_write_guard guard(rwlckTopics);
+    auto& topic = topics[InternTopic(req.topic) - 1];
+    auto& topicAdvertisers = topic.advertisers;
+    if (std::find(topicAdvertisers.begin(), topicAdvertisers.end(), req.advertiserId) == topicAdvertisers.end())
+    {
+        topicAdvertisers.push_back(req.advertiserId);
+    }
+
+    FillSubscribers(topic, resp);
+    conn->PendMessage(resp.toTCPMessage());
+}
+
+void Core::QueryMetrics(std::shared_ptr<TCPConnection> conn, std::shared_ptr<TCPMessage> msg)
+{
+    QueryMetricsMessage req(msg);
+    MetricsMessage resp;
+    resp.messageId = req.messageId;
+    DLOG(INFO) << "QUERY_METRICS: inquirerId:" << req.inquirerId;
+
+    {
+        pssc_read_guard guardTopics(rwlckTopics);
+        resp.topics.reserve(topics.size());
+        for (auto& topic : topics)
+        {
+            auto& stats = *topic.stats;
+            resp.topics.push_back(MetricsMessage::TopicCounters {
+                topic.id, topic.name, (pssc_size)topic.subscribers.size(),
+                stats.messagesIn, stats.bytesIn, stats.messagesOut, stats.bytesOut, stats.dropped });
+        }
+    }
+
+    {
+        pssc_read_guard guardNodes(rwlckNodes);
+        resp.nodes.reserve(nodes.size());
+        for (auto& node : nodes)
+        {
+            auto stats = node.second->GetStats();
+            resp.nodes.push_back(MetricsMessage::NodeCounters {
+                node.first, stats.messagesIn, stats.bytesIn, stats.messagesOut, stats.bytesOut,
+                stats.droppedMessages, stats.queuedMessages, stats.queuedBytes });
+        }
+    }
+
+    for (pssc_ins ins = 0; ins <= Ins::UNKOWN; ++ins)
+    {
+        MetricsMessage::DispatchLatency dispatch;
+        dispatch.ins = ins;
+        dispatchLatencies[ins].Snapshot(dispatch.buckets);
+        if (std::any_of(std::begin(dispatch.buckets), std::end(dispatch.buckets),
+                [](std::uint64_t count) { return count > 0; }))
+        {
+            resp.dispatches.push_back(dispatch);
+        }
     }
 
     conn->PendMessage(resp.toTCPMessage());
 }
 
+pssc_topic_id Core::InternTopic(const std::string& name)
+{
+    auto fd = topicIds.find(name);
+    if (fd != topicIds.end())
+    {
+        return fd->second;
+    }
+
+    Topic topic;
+    topic.id = topics.size() + 1;
+    topic.name = name;
+    topic.stats = std::make_shared<TopicStats>();
+    topics.push_back(topic);
+    topicIds.insert(std::make_pair(name, topic.id));
+    // messages of a topic nobody subscribes to yet are counted too
+    UpdateRoute(topics.back());
+    return topic.id;
+}
+
+Core::Topic* Core::FindTopic(pssc_topic_id topicId)
+{
+    if (topicId == 0 || topicId > topics.size())
+    {
+        return nullptr;
+    }
+    return &topics[topicId - 1];
+}
+
+Core::Topic* Core::FindTopic(const std::string& name)
+{
+    auto fd = topicIds.find(name);
+    if (fd == topicIds.end())
+    {
+        return nullptr;
+    }
+    return &topics[fd->second - 1];
+}
+
+void Core::FillSubscribers(const Topic& topic, TopicSubscribersMessage& msg)
+{
+    msg.topicId = topic.id;
+    msg.topic = topic.name;
+
+    pssc_read_guard guardNodes(rwlckNodes);
+    for (auto& subscriberId : topic.subscribers)
+    {
+        auto endpoint = endpoints.find(subscriberId);
+        if (endpoint == endpoints.end())
+        {
+            continue;
+        }
+        auto limit = topic.limits.find(subscriberId);
+        msg.subscribers.push_back(TopicSubscribersMessage::Subscriber {
+            subscriberId, endpoint->second.address, endpoint->second.port,
+            limit == topic.limits.end() ? util::QueueLimit() : limit->second
+        });
+    }
+}
+
+void Core::UpdateRoute(const Topic& topic)
+{
+    auto route = std::make_shared<Route>();
+    route->stats = topic.stats;
+    {
+        pssc_read_guard guardNodes(rwlckNodes);
+        for (auto& subscriberId : topic.subscribers)
+        {
+            auto subConn = nodes.find(subscriberId);
+            if (subConn == nodes.end())
+            {
+                // disconnected subscriber
+                continue;
+            }
+            auto limit = topic.limits.find(subscriberId);
+            auto endpoint = endpoints.find(subscriberId);
+            bool direct = endpoint != endpoints.end() && endpoint->second.port != 0;
+            route->entries.push_back(RouteEntry { subscriberId, subConn->second,
+                    limit == topic.limits.end() ? util::QueueLimit() : limit->second, direct });
+        }
+    }
+
+    // writers are serialized by rwlckTopics, readers keep the table they loaded
+    auto table = std::make_shared<RoutingTable>(*std::atomic_load(&routes));
+    if (table->size() < topic.id)
+    {
+        table->resize(topic.id);
+    }
+    (*table)[topic.id - 1] = route;
+    std::atomic_store(&routes, std::shared_ptr<const RoutingTable>(table));
+}
+
+void Core::NotifyAdvertisers(const Topic& topic)
+{
+    if (topic.advertisers.empty())
+    {
+        return;
+    }
+
+    TopicSubscribersMessage update(Ins::TOPIC_SUBSCRIBERS);
+    FillSubscribers(topic, update);
+    auto msg = update.toTCPMessage();
+
+    pssc_read_guard guardNodes(rwlckNodes);
+    for (auto& advertiserId : topic.advertisers)
+    {
+        auto advertiser = nodes.find(advertiserId);
+        if (advertiser != nodes.end())
+        {
+            advertiser->second->PendMessage(msg);
+        }
+    }
+}
+
 int Core::Start()
 {
     DLOG(INFO) << "start service.";
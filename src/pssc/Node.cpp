@@ -7,34 +7,56 @@
 
 #include "pssc/protocol/Node.h"
 #include "pssc/protocol/types.h"
+#include "pssc/util/Log.h"
+#include <unistd.h>
+#include <limits>
 
 namespace pssc {
 
+static const size_t SHM_SLOT_ALIGNMENT = 4096;
+// executor keys of services, apart from those of topics which are topic ids
+static const std::uint64_t SERVICE_EXECUTOR_KEY = 1ull << 63;
+// executor key of the callbacks of asynchronous calls
+static const std::uint64_t CALL_EXECUTOR_KEY = SERVICE_EXECUTOR_KEY - 1;
+
 bool Node::Initialize(int port)
 {
     running = true;
 
-    execPub = std::thread(
-        std::bind(&Node::ExecPublish, this)
-    );
-    execPub.detach();
+    executor = std::make_unique<util::Executor>(executorThreads);
 
-    execCall = std::thread(
-        std::bind(&Node::ExecCall, this)
-    );
-    execCall.detach();
+    if (directPublish)
+    {
+        // accept messages published directly by other nodes
+        peerServer = std::make_shared<TCPServer>(
+            0,
+            std::bind(&Node::OnPeerConnected, this, std::placeholders::_1),
+            std::bind(&Node::OnPeerDisconnected, this, std::placeholders::_1)
+        );
+        peerThread = std::thread([this]()
+        {
+            peerServer->Start();
+        });
+        peerThread.detach();
+    }
 
     client = std::make_shared<TCPClient>(
         port,
         std::bind(&Node::OnConntected, this, std::placeholders::_1),
         std::bind(&Node::OnDisconntected, this, std::placeholders::_1)
     );
+    requests = std::make_unique<RequestTable>(client->GetIOService());
 
     client->Connect();
 
     return startNoti.wait_for(std::chrono::milliseconds(300)) == std::cv_status::no_timeout;
 }
 
+std::uint64_t Node::GetDroppedMessages()
+{
+    return droppedMessages;
+}
+
 void Node::OnConntected(std::shared_ptr<TCPConnection> conn)
 {
     this->conn = conn;
@@ -44,15 +66,55 @@ void Node::OnConntected(std::shared_ptr<TCPConnection> conn)
 
     RegisterMessage req;
     req.messageId = messageIdGen.Next();
+    // 0 tells the core that the node does not accept peers
+    req.peerPort = peerServer != nullptr ? peerServer->GetPort() : 0;
+    localAddress = conn->GetLocalAddress();
     conn->PendMessage(req.toTCPMessage());
 }
 
-void Node::OnMessageReceived(std::shared_ptr<TCPMessage> msg)
+void Node::OnPeerConnected(std::shared_ptr<TCPConnection> conn)
+{
+    DLOG(INFO) << "peer connected.";
+    conn->SetOnMessage(std::bind(&Node::DispatchPeerMessage, this, std::placeholders::_1));
+    conn->Start();
+}
+
+void Node::OnPeerDisconnected(std::shared_ptr<TCPConnection> conn)
+{
+    DLOG(INFO) << "peer disconnected.";
+    pssc_write_guard guard(rwlckPeers);
+    for (auto peer = peers.begin(); peer != peers.end(); ++peer)
+    {
+        if (peer->second.conn.get() == conn.get())
+        {
+            // this runs on the io thread of the client, it is not destroyed here
+            RetirePeerClient(peer->second.client);
+            peers.erase(peer);
+            return;
+        }
+    }
+}
+
+void Node::RetirePeerClient(std::shared_ptr<TCPClient> client)
+{
+    if (client != nullptr)
+    {
+        client->Disconnect();
+        retiredPeerClients.push_back(client);
+    }
+}
+
+void Node::DispatchPeerMessage(std::shared_ptr<TCPMessage> msg)
 {
-    mtxMsg.lock();
-    msgList.push_back(msg);
-    mtxMsg.unlock();
-    cvMsg.notify_one();
+    // peers are anyone who connects, they may only publish
+    pssc_ins ins;
+    msg->NextData(ins);
+    if (ins == Ins::PUBLISH || ins == Ins::SHM_PUBLISH)
+    {
+        OnPublish(msg);
+        return;
+    }
+    PSSC_LOG_EVERY_MS(WARNING, 1000) << "instruction " << (int)ins << " from a peer dropped.";
 }
 
 void Node::DispatchMessage(std::shared_ptr<TCPMessage> msg)
@@ -68,12 +130,14 @@ void Node::DispatchMessage(std::shared_ptr<TCPMessage> msg)
         }
 
         case Ins::QUERY_SUBSCRIBER_NUMBER_ACK:
+        case Ins::QUERY_METRICS_ACK:
         {
             OnGenerelResponse(msg);
             break;
         }
 
         case Ins::PUBLISH:
+        case Ins::SHM_PUBLISH:
         {
             OnPublish(msg);
             break;
@@ -81,6 +145,9 @@ void Node::DispatchMessage(std::shared_ptr<TCPMessage> msg)
 
         case Ins::SUBACK:
         {
+            OnSubACK(msg);
+            msg->Reset();
+            msg->IgnoreBytes(SIZE_OF_PSSC_INS);
             OnGenerelResponse(msg);
             break;
         }
@@ -115,6 +182,21 @@ void Node::DispatchMessage(std::shared_ptr<TCPMessage> msg)
             break;
         }
 
+        case Ins::ADVTOPICACK:
+        {
+            OnTopicSubscribers(ins, msg);
+            msg->Reset();
+            msg->IgnoreBytes(SIZE_OF_PSSC_INS);
+            OnGenerelResponse(msg);
+            break;
+        }
+
+        case Ins::TOPIC_SUBSCRIBERS:
+        {
+            OnTopicSubscribers(ins, msg);
+            break;
+        }
+
         default:
         {
             DLOG(ERROR) << "UNKOWN MESSAGE";
@@ -123,62 +205,414 @@ void Node::DispatchMessage(std::shared_ptr<TCPMessage> msg)
     }
 }
 
-void Node::ExecPublish()
+void Node::ExecPublish(std::shared_ptr<TCPMessage> msg, std::shared_ptr<const TopicEntry> entry)
+{
+    // INS has been taken by DispatchMessage, read it again
+    pssc_ins ins;
+    msg->Reset();
+    msg->NextData(ins);
+
+    if (ins == Ins::SHM_PUBLISH)
+    {
+        ExecSHMPublish(msg, entry);
+        return;
+    }
+
+    PublishMessage req(msg);
+    util::Tracer::Record(util::TracePoint::CALLBACK, msg->trace);
+    if (entry->handler)
+    {
+        entry->handler(req.data, req.sizeOfData);
+    }
+    else
+    {
+        topicCallback(entry->name, req.data, req.sizeOfData);
+    }
+}
+
+void Node::ExecSHMPublish(std::shared_ptr<TCPMessage> msg, std::shared_ptr<const TopicEntry> entry)
+{
+    SHMPublishMessage req(msg);
+
+    auto segment = GetSHMReader(req.publisherId, req.topicId, req.segment);
+    if (segment == nullptr)
+    {
+        ++droppedMessages;
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "failed to map shared memory " << req.segment << ", message dropped.";
+        return;
+    }
+
+    auto data = segment->Lock(req.slot, req.seq, req.sizeOfPayload);
+    if (data == nullptr)
+    {
+        // the subscriber fell more than the slot count behind the publisher
+        ++droppedMessages;
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "shared memory slot has been reused, message dropped.";
+        return;
+    }
+
+    // the slot can not be reused by the publisher until it is unlocked
+    util::Tracer::Record(util::TracePoint::CALLBACK, msg->trace);
+    if (entry->handler)
+    {
+        entry->handler(data, req.sizeOfPayload);
+    }
+    else
+    {
+        topicCallback(entry->name, data, req.sizeOfPayload);
+    }
+    segment->Unlock(req.slot);
+}
+
+std::shared_ptr<SHMSegment> Node::GetSHMReader(pssc_id publisherId, pssc_topic_id topicId, std::string& name)
+{
+    pssc_lock_guard lck(mtxSHM);
+    auto key = std::make_pair(publisherId, topicId);
+    auto fd = shmReaders.find(key);
+    if (fd != shmReaders.end() && fd->second->GetName() == name)
+    {
+        return fd->second;
+    }
+
+    // first message or the publisher has replaced its segment
+    auto segment = SHMSegment::Open(name);
+    if (segment == nullptr)
+    {
+        return nullptr;
+    }
+    shmReaders[key] = segment;
+    return segment;
+}
+
+std::shared_ptr<SHMSegment> Node::GetSHMWriter(std::string& topic, size_t size)
+{
+    pssc_lock_guard lck(mtxSHM);
+    auto fd = shmWriters.find(topic);
+    if (fd != shmWriters.end() && fd->second->GetSlotSize() >= size)
+    {
+        return fd->second;
+    }
+
+    // leave some room for payloads of variable size, e.g. compressed images
+    auto slotSize = (size + size / 4 + SHM_SLOT_ALIGNMENT - 1) / SHM_SLOT_ALIGNMENT * SHM_SLOT_ALIGNMENT;
+    auto name = "/pssc." + std::to_string(getpid())
+            + "." + std::to_string(nodeId)
+            + "." + std::to_string(shmIdGen.Next());
+    auto segment = SHMSegment::Create(name, slotSize, shmSlotCount);
+    if (segment == nullptr)
+    {
+        return nullptr;
+    }
+    shmWriters[topic] = segment;
+    return segment;
+}
+
+bool Node::PrepareLoan(PublishLoan& loan, std::string& topic, size_t size)
+{
+    loan.topic = topic;
+    if (size > std::numeric_limits<pssc_size>::max() - PublishMessage::SIZE_OF_MESSAGE_NECCESSARY)
+    {
+        LOG(WARNING) << "payload of " << size << " bytes for topic " << topic << " is too large to publish.";
+        return false;
+    }
+
+    loan.topicId = GetTopicId(topic);
+    loan.size = size;
+    loan.loanedAt = util::Tracer::IsEnabled() ? util::Tracer::Now() : 0;
+    if (loan.topicId == 0)
+    {
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "failed to get the id of topic " << topic << ", it will not be delivered.";
+    }
+
+    if (shmThreshold > 0 && size >= shmThreshold && SubscribersOnThisHost(topic))
+    {
+        auto segment = GetSHMWriter(topic, size);
+        if (segment != nullptr)
+        {
+            loan.data = segment->Acquire(size, loan.slot);
+            if (loan.data != nullptr)
+            {
+                loan.segment = segment;
+                return true;
+            }
+            // every slot is still read by subscribers, fall back to tcp
+        }
+    }
+
+    // the payload is written into the body of the message to send
+    PublishMessage req;
+    req.messageId = messageIdGen.Next();
+    req.publisherId = nodeId;
+    req.topicId = loan.topicId;
+    req.sizeOfData = size;
+    loan.msg = req.toTCPMessageInPlace();
+    loan.data = req.data;
+    if (loan.loanedAt != 0)
+    {
+        loan.msg->trace.Tag(nodeId, req.messageId, loan.topicId);
+    }
+    return true;
+}
+
+std::shared_ptr<TCPMessage> Node::CommitLoan(PublishLoan& loan, bool feedback)
+{
+    std::shared_ptr<TCPMessage> msg;
+    if (loan.segment != nullptr)
+    {
+        SHMPublishMessage req;
+        req.messageId = messageIdGen.Next();
+        req.publisherId = nodeId;
+        req.topicId = loan.topicId;
+        req.segment = loan.segment->GetName();
+        req.slot = loan.slot;
+        req.seq = loan.segment->Commit(loan.slot, loan.size);
+        req.sizeOfPayload = loan.size;
+        req.feedback = feedback;
+        msg = req.toTCPMessage();
+        if (loan.loanedAt != 0)
+        {
+            msg->trace.Tag(nodeId, req.messageId, loan.topicId);
+        }
+    }
+    else
+    {
+        loan.msg->AppendData(feedback);
+        loan.msg->AppendData(PublishMessage::RELAY_ALL);
+        msg = loan.msg;
+    }
+
+    util::Tracer::Record(util::TracePoint::PUBLISH, msg->trace, loan.loanedAt);
+    loan.data = nullptr;
+    return msg;
+}
+
+std::shared_ptr<TCPConnection> Node::GetPeerConnection(const TopicSubscribersMessage::Subscriber& subscriber)
+{
+    {
+        pssc_read_guard guard(rwlckPeers);
+        auto peer = peers.find(subscriber.nodeId);
+        if (peer != peers.end() && peer->second.conn->IsRunning())
+        {
+            return peer->second.conn;
+        }
+    }
+
+    if (subscriber.port == 0)
+    {
+        return nullptr;
+    }
+
+    // connecting blocks, publishers of other topics go on meanwhile
+    Peer p;
+    auto connected = std::make_shared<std::shared_ptr<TCPConnection>>();
+    try {
+        p.client = std::make_shared<TCPClient>(
+            subscriber.address,
+            subscriber.port,
+            [connected, this](std::shared_ptr<TCPConnection> conn)
+            {
+                conn->SetOnMessage(std::bind(&Node::DispatchPeerMessage, this, std::placeholders::_1));
+                conn->SetMaxQueuedBytes(maxPeerQueuedBytes);
+                *connected = conn;
+            },
+            std::bind(&Node::OnPeerDisconnected, this, std::placeholders::_1)
+        );
+        p.client->Connect();
+    } catch (...) {
+        DLOG(WARNING) << "failed to connect to node with id " << subscriber.nodeId;
+        return nullptr;
+    }
+    p.conn = *connected;
+
+    pssc_write_guard guard(rwlckPeers);
+    auto& peer = peers[subscriber.nodeId];
+    if (peer.conn != nullptr && peer.conn->IsRunning())
+    {
+        // connected by another publisher in the meantime
+        p.conn->Stop();
+        RetirePeerClient(p.client);
+        return peer.conn;
+    }
+    RetirePeerClient(peer.client);
+    peer = p;
+    return p.conn;
+}
+
+std::shared_ptr<const Node::Subscribers> Node::GetTopicSubscribers(std::string& topic)
+{
+    {
+        pssc_read_guard guard(rwlckPeers);
+        auto fd = topicSubscribers.find(topic);
+        if (fd != topicSubscribers.end())
+        {
+            return fd->second;
+        }
+    }
+
+    if (!AdvertiseTopic(topic))
+    {
+        return nullptr;
+    }
+
+    pssc_read_guard guard(rwlckPeers);
+    return topicSubscribers.at(topic);
+}
+
+bool Node::SubscribersOnThisHost(std::string& topic)
 {
-    while (running)
+    auto subscribers = GetTopicSubscribers(topic);
+    if (subscribers == nullptr)
+    {
+        return false;
+    }
+
+    // the core sees nodes of one host at the same address
+    for (auto& subscriber : *subscribers)
+    {
+        if (subscriber.nodeId != nodeId && subscriber.address != localAddress)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Node::PublishDirectly(std::string& topic, pssc_topic_id topicId, std::shared_ptr<TCPMessage> msg, bool feedback)
+{
+    auto subscribers = GetTopicSubscribers(topic);
+    if (subscribers == nullptr)
+    {
+        // the core relays it to every subscriber, this node included for feedback
+        conn->PendMessage(msg, topicId, TCPConnection::Priority::REALTIME);
+        return;
+    }
+
+    // all the peers are resolved before anything is sent, so the copy through
+    // the core knows which subscribers it still has to reach
+    std::vector<std::pair<std::shared_ptr<TCPConnection>, const util::QueueLimit*>> peerConns;
+    bool self = false;
+    bool peerless = false;
+    for (auto& subscriber : *subscribers)
+    {
+        if (subscriber.nodeId == nodeId)
+        {
+            self = true;
+            continue;
+        }
+
+        if (subscriber.port == 0)
+        {
+            peerless = true;
+            continue;
+        }
+
+        auto peerConn = GetPeerConnection(subscriber);
+        if (peerConn == nullptr)
+        {
+            PSSC_LOG_EVERY_MS(WARNING, 1000) << "node with id " << subscriber.nodeId << " is unreachable, relayed by the core.";
+            conn->PendMessage(msg, topicId, TCPConnection::Priority::REALTIME);
+            return;
+        }
+        peerConns.push_back(std::make_pair(peerConn, &subscriber.limit));
+    }
+
+    PublishMessage::SetRelay(msg, PublishMessage::RELAY_PEERLESS);
+    if (self && feedback)
+    {
+        // msg is committed and shared with the peers, read a view of it
+        auto local = msg->View();
+        local->IgnoreBytes(SIZE_OF_PSSC_INS);
+        OnPublish(local);
+    }
+
+    for (auto& peerConn : peerConns)
     {
-        std::unique_lock<std::mutex> lck(mtxMsg);
-        if (msgList.empty())
+        // a slow peer is held to its limit like in the core
+        if (!peerConn.first->PendMessage(msg, topicId, *peerConn.second, TCPConnection::Priority::REALTIME))
         {
-            cvMsg.wait(lck);
+            ++droppedMessages;
         }
+    }
 
-        auto msg = *msgList.begin();
-        msgList.pop_front();
+    if (peerless)
+    {
+        conn->PendMessage(msg, topicId, TCPConnection::Priority::REALTIME);
+    }
+}
 
-        PublishMessage req(msg);
-        topicCallback(req.topic, req.data, req.sizeOfData);
+void Node::AddTopicId(pssc_topic_id topicId, const std::string& topic)
+{
+    pssc_write_guard guard(rwlckTopics);
+    topicIds[topic] = topicId;
+    if (topicEntries.find(topicId) == topicEntries.end())
+    {
+        topicEntries[topicId] = MakeTopicEntry(topic, nullptr, util::QueueLimit());
     }
 }
 
-void Node::ExecCall()
+void Node::SetTopicEntry(pssc_topic_id topicId, std::shared_ptr<const TopicEntry> entry)
+{
+    pssc_write_guard guard(rwlckTopics);
+    topicIds[entry->name] = topicId;
+    topicEntries[topicId] = entry;
+}
+
+pssc_topic_id Node::GetTopicId(std::string& topic)
 {
-    while (running)
     {
-        std::unique_lock<std::mutex> lck(mtxCall);
-        if (callList.empty())
+        pssc_read_guard guard(rwlckTopics);
+        auto fd = topicIds.find(topic);
+        if (fd != topicIds.end())
         {
-            cvCall.wait(lck);
+            return fd->second;
         }
+    }
+
+    // the ack of the advertisement carries the id
+    if (!AdvertiseTopic(topic))
+    {
+        return 0;
+    }
 
-        auto msg = *callList.begin();
-        callList.pop_front();
+    pssc_read_guard guard(rwlckTopics);
+    auto fd = topicIds.find(topic);
+    return fd == topicIds.end() ? 0 : fd->second;
+}
 
-        ServiceCallMessage req(msg);
-        auto op = std::make_shared<ResponseOperator>();
-        op->messageId = req.messageId;
-        op->callerId = req.callerId;
-        op->conn = conn;
-        srvCallback(req.srv_name, req.data, req.sizeOfData, op);
+std::shared_ptr<const Node::TopicEntry> Node::GetTopicEntry(pssc_topic_id topicId)
+{
+    pssc_read_guard guard(rwlckTopics);
+    auto fd = topicEntries.find(topicId);
+    if (fd == topicEntries.end())
+    {
+        return nullptr;
     }
+    return fd->second;
+}
+
+void Node::ExecCall(std::shared_ptr<TCPMessage> msg)
+{
+    ServiceCallMessage req(msg);
+    auto op = std::make_shared<ResponseOperator>();
+    op->messageId = req.messageId;
+    op->callerId = req.callerId;
+    op->conn = conn;
+    op->request = msg;
+    srvCallback(req.srv_name, req.data, req.sizeOfData, op);
 }
 
 void Node::OnGenerelResponse(std::shared_ptr<TCPMessage> msg)
 {
-    LOG(INFO) << "Received Response.";
+    PSSC_LOG(TRACE) << "Received Response.";
     pssc_id messageId;
     msg->NextData(messageId);
     msg->Reset();
     msg->IgnoreBytes(SIZE_OF_PSSC_INS);
 
-    mtxAcks.lock();
-//    acks.insert(std::pair<pssc_id, std::shared_ptr<TCPMessage>>(messageId, msg));
-    acks.insert(std::make_pair(messageId, msg));
-    auto funcNoti = mapAckNoti.at(messageId);
-    mapAckNoti.erase(messageId);
-    mtxAcks.unlock();
-
-    funcNoti();
+    if (!requests->Complete(messageId, msg))
+    {
+        PSSC_LOG_EVERY_MS(DEBUG, 1000) << "response to a request timed out or cancelled: " << messageId;
+    }
 }
 
 void Node::OnRegACK(std::shared_ptr<TCPMessage> msg)
@@ -196,61 +630,235 @@ void Node::OnRegACK(std::shared_ptr<TCPMessage> msg)
     }
 }
 
+std::shared_ptr<const Node::TopicEntry> Node::MakeTopicEntry(const std::string& topic,
+        TopicHandler handler, const util::QueueLimit& limit)
+{
+    return std::make_shared<const TopicEntry>(TopicEntry { topic, handler, std::make_shared<Inbox>(limit) });
+}
+
+void Node::Deliver(std::uint64_t key, std::shared_ptr<Inbox> inbox, std::shared_ptr<TCPMessage> msg,
+        std::function<void(std::shared_ptr<TCPMessage>)> exec)
+{
+    if (!inbox->Bounded())
+    {
+        // the io thread never waits for the callbacks, they may be waiting for it
+        if (inbox->overflowed > 0 || !inbox->ring.TryPush(msg))
+        {
+            std::lock_guard<std::mutex> lck(inbox->mtxOverflow);
+            inbox->overflow.push_back(msg);
+            ++inbox->overflowed;
+        }
+    }
+    else
+    {
+        while (!inbox->ring.TryPush(msg))
+        {
+            if (inbox->limit.policy == util::QueuePolicy::DROP_NEWEST)
+            {
+                ++droppedMessages;
+                return;
+            }
+
+            std::shared_ptr<TCPMessage> oldest;
+            if (inbox->ring.TryPop(oldest))
+            {
+                ++droppedMessages;
+            }
+        }
+    }
+
+    // only the push finding an idle worker wakes up the executor, a busy worker
+    // takes the message after its current one
+    for (size_t worker = 0; worker < inbox->workers; ++worker)
+    {
+        if (!inbox->scheduled[worker].exchange(true))
+        {
+            executor->Post(key + worker, std::bind(&Node::DrainInbox, this, key + worker, inbox, worker, exec));
+            break;
+        }
+    }
+}
+
+void Node::DrainInbox(std::uint64_t key, std::shared_ptr<Inbox> inbox, size_t worker,
+        std::function<void(std::shared_ptr<TCPMessage>)> exec)
+{
+    std::shared_ptr<TCPMessage> msg;
+    for (size_t n = 0; n < MAX_DRAIN_BATCH; ++n)
+    {
+        if (!TakeFromInbox(*inbox, msg))
+        {
+            inbox->scheduled[worker] = false;
+            // a message pushed before the flag was cleared did not post a task
+            if ((inbox->ring.Empty() && inbox->overflowed == 0) || inbox->scheduled[worker].exchange(true))
+            {
+                return;
+            }
+            continue;
+        }
+
+        exec(msg);
+        msg.reset();
+    }
+
+    // let other topics run, the inbox is still scheduled
+    executor->Post(key, std::bind(&Node::DrainInbox, this, key, inbox, worker, exec));
+}
+
+bool Node::TakeFromInbox(Inbox& inbox, std::shared_ptr<TCPMessage>& msg)
+{
+    if (inbox.ring.TryPop(msg))
+    {
+        return true;
+    }
+    if (inbox.overflowed == 0)
+    {
+        return false;
+    }
+
+    // nothing goes into the ring while the overflow is not empty
+    std::lock_guard<std::mutex> lck(inbox.mtxOverflow);
+    if (inbox.overflow.empty())
+    {
+        return false;
+    }
+    msg = std::move(inbox.overflow.front());
+    inbox.overflow.pop_front();
+    --inbox.overflowed;
+    return true;
+}
+
+std::shared_ptr<Node::Inbox> Node::GetServiceInbox(const std::string& srv_name)
+{
+    {
+        pssc_read_guard guard(rwlckSrvInboxes);
+        auto fd = srvInboxes.find(srv_name);
+        if (fd != srvInboxes.end())
+        {
+            return fd->second;
+        }
+    }
+
+    pssc_write_guard guard(rwlckSrvInboxes);
+    auto& inbox = srvInboxes[srv_name];
+    if (inbox == nullptr)
+    {
+        inbox = std::make_shared<Inbox>(util::QueueLimit(), srvConcurrency);
+    }
+    return inbox;
+}
+
+void Node::OnSubACK(std::shared_ptr<TCPMessage> msg)
+{
+    // install the entry before messages of the topic behind the ack are dispatched
+    SubACKMessage ack(msg);
+    std::shared_ptr<const TopicEntry> entry;
+    {
+        pssc_write_guard guard(rwlckTopics);
+        auto fd = pendingSubs.find(ack.messageId);
+        if (fd == pendingSubs.end())
+        {
+            return;
+        }
+        entry = fd->second;
+        pendingSubs.erase(fd);
+    }
+
+    if (ack.success)
+    {
+        SetTopicEntry(ack.topicId, entry);
+    }
+}
+
 void Node::OnSrvCall(std::shared_ptr<TCPMessage> msg)
 {
-    mtxCall.lock();
-    callList.push_back(msg);
-    mtxCall.unlock();
-    cvCall.notify_one();
+    // INS has been taken, calls of a service are kept in order without concurrency
+    // | ID | CALLER_ID | SIZE_OF_SRV_NAME | SRV_NAME |
+    pssc_id messageId, callerId;
+    std::string srv_name;
+    msg->NextData(messageId);
+    msg->NextData(callerId);
+    msg->NextData(srv_name);
+    msg->Reset();
+    msg->IgnoreBytes(SIZE_OF_PSSC_INS);
+
+    // the workers of the service take the next call whenever they are free,
+    // its key leaves room below the top bit for a key per worker
+    Deliver(SERVICE_EXECUTOR_KEY | (std::hash<std::string>()(srv_name) >> 2),
+            GetServiceInbox(srv_name), msg,
+            std::bind(&Node::ExecCall, this, std::placeholders::_1));
 
-    LOG(INFO) << "Received Service Call.";
+    PSSC_LOG(TRACE) << "Received Service Call.";
 }
 
 void Node::OnPublish(std::shared_ptr<TCPMessage> msg)
 {
-    mtxMsg.lock();
-    msgList.push_back(msg);
-    mtxMsg.unlock();
-    cvMsg.notify_one();
+    // INS has been taken, PUBLISH and SHM_PUBLISH both start with
+    // | ID | PUBLISHER_ID | TOPIC_ID |, messages of a topic are kept in order
+    pssc_id messageId, publisherId;
+    pssc_topic_id topicId;
+    msg->NextData(messageId);
+    msg->NextData(publisherId);
+    msg->NextData(topicId);
+
+    if (util::Tracer::IsEnabled())
+    {
+        // messages published to this node itself are tagged and were not read from a socket
+        if (!msg->trace.traced)
+        {
+            msg->trace.Tag(publisherId, messageId, topicId);
+        }
+        util::Tracer::Record(util::TracePoint::RECEIVE, msg->trace,
+                msg->trace.receivedAt != 0 ? msg->trace.receivedAt : util::Tracer::Now());
+    }
+
+    auto entry = GetTopicEntry(topicId);
+    if (entry == nullptr)
+    {
+        PSSC_LOG_EVERY_MS(WARNING, 1000) << "message of unknown topic id " << topicId << " dropped.";
+        return;
+    }
+
+    Deliver(topicId, entry->inbox, msg,
+            std::bind(&Node::ExecPublish, this, std::placeholders::_1, entry));
+
+    PSSC_LOG(TRACE) << "Received Publish.";
+}
+
+void Node::OnTopicSubscribers(pssc_ins ins, std::shared_ptr<TCPMessage> msg)
+{
+    TopicSubscribersMessage update(ins, msg);
+    DLOG(INFO) << "subscribers of " << update.topic << ": " << update.subscribers.size();
 
-    LOG(INFO) << "Received Publish.";
+    AddTopicId(update.topicId, update.topic);
+
+    auto subscribers = std::make_shared<const Subscribers>(std::move(update.subscribers));
+    pssc_write_guard guard(rwlckPeers);
+    topicSubscribers[update.topic] = subscribers;
 }
 
-void Node::OnDisconntected(std::shared_ptr<TCPConnection> conn)
+void Node::OnDisconntected(std::shared_ptr<TCPConnection>)
 {
     running = false;
     DLOG(INFO) << "disconnected.";
+
+    // no response will come any more
+    requests->CompleteAll();
 }
 
-bool Node::SendRequestAndWaitForResponse(pssc_id messageId, std::shared_ptr<TCPMessage> req, std::shared_ptr<TCPMessage>& resp)
+bool Node::SendRequestAndWaitForResponse(pssc_id messageId, std::shared_ptr<TCPMessage> req, std::shared_ptr<TCPMessage>& resp,
+        TCPConnection::Priority priority)
 {
-    auto noti = std::make_shared<util::Notifier>();
-    auto f = [noti]()
-    {
-        noti->notify_one();
-    };
+    conn->PendMessage(req, priority);
 
-    mtxAcks.lock();
-//    mapAckNoti.insert(std::pair<pssc_id, std::function<void()>>(messageId, f));
-    mapAckNoti.insert(std::make_pair(messageId, f));
-    mtxAcks.unlock();
-    conn->PendMessage(req);
-
-//    auto rlt = noti->wait_for(std::chrono::milliseconds(3000));
-//    if (rlt == std::cv_status::timeout)
-//    {
-//        return false;
-//    }
-    noti->wait();
-    std::lock_guard<std::mutex> lck(mtxAcks);
-    resp = acks.at(messageId);
-    return true;
+    // the deadline, if any, completes the request
+    resp = requests->Wait(messageId);
+    return resp != nullptr;
 }
 
 pssc_size Node::QuerySubNum(std::string topic)
 {
     QuerySubNumMessage query;
-    query.messageId = messageIdGen.Next();
+    query.messageId = requests->Add(nullptr);
     query.inquirerId = nodeId;
     query.topic = topic;
 
@@ -264,33 +872,103 @@ pssc_size Node::QuerySubNum(std::string topic)
     return resp.subNum;
 }
 
-void Node::Publish(std::string topic, std::uint8_t*data, size_t size, bool feedback)
+std::shared_ptr<MetricsMessage> Node::QueryMetrics()
 {
-    PublishMessage req;
-    req.messageId = messageIdGen.Next();
-    req.publisherId = nodeId;
+    QueryMetricsMessage query;
+    query.messageId = requests->Add(nullptr);
+    query.inquirerId = nodeId;
+
+    std::shared_ptr<TCPMessage> msg;
+    if(!SendRequestAndWaitForResponse(query.messageId, query.toTCPMessage(), msg))
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<MetricsMessage>(msg);
+}
+
+bool Node::Publish(std::string topic, std::uint8_t*data, size_t size, bool feedback)
+{
+    PublishLoan loan;
+    if (!PrepareLoan(loan, topic, size))
+    {
+        return false;
+    }
+    memcpy(loan.data, data, size);
+    SendPublish(topic, loan.topicId, CommitLoan(loan, feedback), feedback);
+    return true;
+}
+
+std::shared_ptr<Node::PublishLoan> Node::Loan(std::string topic, size_t size)
+{
+    auto loan = std::make_shared<PublishLoan>();
+    PrepareLoan(*loan, topic, size);
+    return loan;
+}
+
+void Node::Commit(std::shared_ptr<PublishLoan> loan, bool feedback)
+{
+    if (loan->data == nullptr)
+    {
+        LOG(WARNING) << "loan of " << loan->topic << " has been committed or is empty.";
+        return;
+    }
+
+    SendPublish(loan->topic, loan->topicId, CommitLoan(*loan, feedback), feedback);
+}
+
+void Node::SendPublish(std::string& topic, pssc_topic_id topicId, std::shared_ptr<TCPMessage> msg, bool feedback)
+{
+    if (directPublish)
+    {
+        PublishDirectly(topic, topicId, msg, feedback);
+    }
+    else
+    {
+        conn->PendMessage(msg, topicId, TCPConnection::Priority::REALTIME);
+    }
+}
+
+bool Node::AdvertiseTopic(std::string topic)
+{
+    AdvertiseTopicMessage req;
+    req.messageId = requests->Add(nullptr);
+    req.advertiserId = nodeId;
     req.topic = topic;
-    req.sizeOfData = size;
-    req.data = data;
-    req.feedback = feedback;
 
-    conn->PendMessage(req.toTCPMessage());
+    // the subscribers in the ack are taken by DispatchMessage
+    std::shared_ptr<TCPMessage> msg;
+    return SendRequestAndWaitForResponse(req.messageId, req.toTCPMessage(), msg);
 }
 
 
 bool Node::Subscribe(std::string topic)
+{
+    return Subscribe(topic, nullptr);
+}
+
+bool Node::Subscribe(std::string topic, TopicHandler handler, util::QueueLimit limit)
 {
     SubscribeMessage req;
-    req.messageId = messageIdGen.Next();
+    req.messageId = requests->Add(nullptr);
     req.subscriberId = nodeId;
     req.topic = topic;
+    req.limit = limit;
+
+    {
+        pssc_write_guard guard(rwlckTopics);
+        pendingSubs[req.messageId] = MakeTopicEntry(topic, handler, limit);
+    }
 
     std::shared_ptr<TCPMessage> msg;
     if(!SendRequestAndWaitForResponse(req.messageId, req.toTCPMessage(), msg))
     {
+        pssc_write_guard guard(rwlckTopics);
+        pendingSubs.erase(req.messageId);
         return false;
     }
 
+    // the entry has been installed by OnSubACK
     SubACKMessage resp(msg);
     return resp.success;
 }
@@ -298,7 +976,7 @@ bool Node::Subscribe(std::string topic)
 bool Node::UnSubscribe(std::string topic)
 {
     UnSubscribeMessage req;
-    req.messageId = messageIdGen.Next();
+    req.messageId = requests->Add(nullptr);
     req.subscriberId = nodeId;
     req.topic = topic;
 
@@ -309,6 +987,16 @@ bool Node::UnSubscribe(std::string topic)
     }
 
     UnSubACKMessage resp(msg);
+    if (resp.success)
+    {
+        // the id is kept for publishing, the handler is not needed any more
+        pssc_write_guard guard(rwlckTopics);
+        auto fd = topicIds.find(topic);
+        if (fd != topicIds.end())
+        {
+            topicEntries[fd->second] = MakeTopicEntry(topic, nullptr, util::QueueLimit());
+        }
+    }
     return resp.success;
 //    conn->PendMessage(req.toTCPMessage());
     return true;
@@ -317,7 +1005,7 @@ bool Node::UnSubscribe(std::string topic)
 bool Node::AdvertiseService(std::string srv_name)
 {
     AdvertiseServiceMessage req;
-    req.messageId = messageIdGen.Next();
+    req.messageId = requests->Add(nullptr);
     req.advertiserId = nodeId;
     req.srv_name = srv_name;
 
@@ -334,7 +1022,7 @@ bool Node::AdvertiseService(std::string srv_name)
 bool Node::CloseService(std::string srv_name)
 {
     CloseServiceMessage req;
-    req.messageId = messageIdGen.Next();
+    req.messageId = requests->Add(nullptr);
     req.advertiserId = nodeId;
     req.srv_name = srv_name;
 
@@ -348,17 +1036,26 @@ bool Node::CloseService(std::string srv_name)
     return resp.success;
 }
 
-std::shared_ptr<Node::ResponseData> Node::RemoteCall(std::string srv_name, std::uint8_t* data, size_t size)
+std::shared_ptr<TCPMessage> Node::MakeServiceCall(pssc_id messageId, const std::string& srv_name,
+        std::uint8_t* data, size_t size)
 {
     ServiceCallMessage req;
-    req.messageId = messageIdGen.Next();
+    req.messageId = messageId;
     req.callerId = nodeId;
     req.srv_name = srv_name;
     req.sizeOfData = size;
     req.data = data;
+    return req.toTCPMessage();
+}
+
+std::shared_ptr<Node::ResponseData> Node::RemoteCall(std::string srv_name, std::uint8_t* data, size_t size,
+        std::chrono::milliseconds timeout)
+{
+    auto messageId = requests->Add(nullptr, timeout);
 
     std::shared_ptr<TCPMessage> msg;
-    if(!SendRequestAndWaitForResponse(req.messageId, req.toTCPMessage(), msg))
+    if(!SendRequestAndWaitForResponse(messageId, MakeServiceCall(messageId, srv_name, data, size), msg,
+            TCPConnection::Priority::SERVICE))
     {
         return std::make_shared<Node::ResponseData>(false);
     }
@@ -367,16 +1064,67 @@ std::shared_ptr<Node::ResponseData> Node::RemoteCall(std::string srv_name, std::
     return std::make_shared<Node::ResponseData>(resp);
 }
 
+pssc_id Node::RemoteCallAsync(std::string srv_name, std::uint8_t* data, size_t size, CallCallback callback,
+        std::chrono::milliseconds timeout)
+{
+    auto messageId = requests->Add([this, callback](std::shared_ptr<TCPMessage> msg)
+    {
+        auto resp = msg == nullptr ? std::make_shared<Node::ResponseData>(false)
+                : std::make_shared<Node::ResponseData>(std::make_shared<ServiceResponseMessage>(msg));
+        // not on the io thread, callback may wait for another call
+        executor->Post(CALL_EXECUTOR_KEY, [callback, resp]()
+        {
+            callback(resp);
+        });
+    }, timeout);
+
+    conn->PendMessage(MakeServiceCall(messageId, srv_name, data, size), TCPConnection::Priority::SERVICE);
+    return messageId;
+}
+
+std::future<std::shared_ptr<Node::ResponseData>> Node::RemoteCallAsync(std::string srv_name,
+        std::uint8_t* data, size_t size, std::chrono::milliseconds timeout)
+{
+    auto promise = std::make_shared<std::promise<std::shared_ptr<Node::ResponseData>>>();
+    auto result = promise->get_future();
+    auto messageId = requests->Add([promise](std::shared_ptr<TCPMessage> msg)
+    {
+        promise->set_value(msg == nullptr ? std::make_shared<Node::ResponseData>(false)
+                : std::make_shared<Node::ResponseData>(std::make_shared<ServiceResponseMessage>(msg)));
+    }, timeout);
+
+    conn->PendMessage(MakeServiceCall(messageId, srv_name, data, size), TCPConnection::Priority::SERVICE);
+    return result;
+}
+
+bool Node::CancelCall(pssc_id callId)
+{
+    return requests->Complete(callId, nullptr);
+}
+
+Node::ResponseOperator::~ResponseOperator()
+{
+    if (conn != nullptr && !responded)
+    {
+        SendResponse(false, nullptr, 0);
+    }
+}
+
 void Node::ResponseOperator::SendResponse(bool success,
         std::uint8_t* data, size_t size)
 {
+    if (responded.exchange(true))
+    {
+        return;
+    }
+
     ServiceResponseMessage resp;
     resp.success = success;
     resp.messageId = messageId;
     resp.callerId = callerId;
     resp.sizeOfData = size;
     resp.data = data;
-    conn->PendMessage(resp.toTCPMessage());
+    conn->PendMessage(resp.toTCPMessage(), TCPConnection::Priority::SERVICE);
 }
 
 }
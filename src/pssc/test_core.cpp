@@ -25,7 +25,7 @@
 
 int main()
 {
-    pssc::Core core(20001);
+    pssc::Core core(20001, std::thread::hardware_concurrency());
     return core.Start();
 }
 
@@ -0,0 +1,224 @@
+/*
+ * SHMSegment.cpp
+ *
+ *  Created on: May 3, 2021
+ *      Author: ubuntu
+ */
+
+#include <glog/logging.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pssc/transport/shm/SHMSegment.h"
+
+namespace trs
+{
+
+static const size_t SLOT_ALIGNMENT = 64;
+
+static inline size_t AlignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+std::shared_ptr<SHMSegment> SHMSegment::Create(const std::string& name,
+        size_t slotSize, std::uint32_t slotCount)
+{
+    auto slotStride = AlignUp(sizeof(SlotHeader) + slotSize, SLOT_ALIGNMENT);
+    auto length = AlignUp(sizeof(SegmentHeader), SLOT_ALIGNMENT) + slotStride * slotCount;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        DLOG(ERROR) << "failed to create shared memory " << name;
+        return nullptr;
+    }
+
+    if (ftruncate(fd, length) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        DLOG(ERROR) << "failed to resize shared memory " << name;
+        return nullptr;
+    }
+
+    auto base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        DLOG(ERROR) << "failed to map shared memory " << name;
+        return nullptr;
+    }
+
+    std::shared_ptr<SHMSegment> segment(new SHMSegment());
+    segment->name = name;
+    segment->owner = true;
+    segment->base = base;
+    segment->length = length;
+    segment->slotSize = slotSize;
+    segment->slotStride = slotStride;
+    segment->slotCount = slotCount;
+    segment->nextSlot = 0;
+
+    for (std::uint32_t i = 0; i < slotCount; ++i)
+    {
+        auto s = new (segment->GetSlot(i)) SlotHeader;
+        s->seq = 0;
+        s->readers = 0;
+        s->size = 0;
+    }
+
+    auto header = (SegmentHeader*)base;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+
+    return segment;
+}
+
+std::shared_ptr<SHMSegment> SHMSegment::Open(const std::string& name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+    {
+        DLOG(ERROR) << "failed to open shared memory " << name;
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SegmentHeader))
+    {
+        close(fd);
+        DLOG(ERROR) << "invalid shared memory " << name;
+        return nullptr;
+    }
+
+    auto base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        DLOG(ERROR) << "failed to map shared memory " << name;
+        return nullptr;
+    }
+
+    auto header = (SegmentHeader*)base;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->magic != MAGIC)
+    {
+        munmap(base, st.st_size);
+        DLOG(ERROR) << "shared memory " << name << " is not ready";
+        return nullptr;
+    }
+
+    std::shared_ptr<SHMSegment> segment(new SHMSegment());
+    segment->name = name;
+    segment->owner = false;
+    segment->base = base;
+    segment->length = st.st_size;
+    segment->slotSize = header->slotSize;
+    segment->slotStride = AlignUp(sizeof(SlotHeader) + header->slotSize, SLOT_ALIGNMENT);
+    segment->slotCount = header->slotCount;
+    segment->nextSlot = 0;
+
+    if (AlignUp(sizeof(SegmentHeader), SLOT_ALIGNMENT)
+            + segment->slotStride * segment->slotCount > segment->length)
+    {
+        DLOG(ERROR) << "shared memory " << name << " is truncated";
+        return nullptr;
+    }
+
+    return segment;
+}
+
+SHMSegment::~SHMSegment()
+{
+    munmap(base, length);
+    if (owner)
+    {
+        shm_unlink(name.c_str());
+    }
+}
+
+SHMSegment::SlotHeader* SHMSegment::GetSlot(std::uint32_t slot)
+{
+    return (SlotHeader*)((std::uint8_t*)base
+            + AlignUp(sizeof(SegmentHeader), SLOT_ALIGNMENT) + slotStride * slot);
+}
+
+std::uint8_t* SHMSegment::Acquire(size_t size, std::uint32_t& slot)
+{
+    if (size > slotSize)
+    {
+        return nullptr;
+    }
+
+    for (std::uint32_t i = 0; i < slotCount; ++i)
+    {
+        auto candidate = nextSlot++ % slotCount;
+        auto s = GetSlot(candidate);
+        if (s->readers.load() > 0)
+        {
+            continue;
+        }
+
+        auto seq = s->seq.load();
+        if ((seq & 1) || !s->seq.compare_exchange_strong(seq, seq + 1))
+        {
+            // being written by another thread
+            continue;
+        }
+
+        // a reader may have locked the slot before it saw the odd sequence
+        if (s->readers.load() > 0)
+        {
+            s->seq.store(seq);
+            continue;
+        }
+
+        slot = candidate;
+        return GetSlotData(candidate);
+    }
+
+    return nullptr;
+}
+
+std::uint64_t SHMSegment::Commit(std::uint32_t slot, size_t size)
+{
+    auto s = GetSlot(slot);
+    s->size = size;
+    return s->seq.fetch_add(1) + 1;
+}
+
+void SHMSegment::Abort(std::uint32_t slot)
+{
+    auto s = GetSlot(slot);
+    s->seq.fetch_add(1);
+}
+
+std::uint8_t* SHMSegment::Lock(std::uint32_t slot, std::uint64_t seq, size_t size)
+{
+    if (slot >= slotCount)
+    {
+        return nullptr;
+    }
+
+    auto s = GetSlot(slot);
+    s->readers.fetch_add(1);
+    if (s->seq.load() != seq || s->size != size)
+    {
+        s->readers.fetch_sub(1);
+        return nullptr;
+    }
+
+    return GetSlotData(slot);
+}
+
+void SHMSegment::Unlock(std::uint32_t slot)
+{
+    GetSlot(slot)->readers.fetch_sub(1);
+}
+
+}
@@ -0,0 +1,105 @@
+/*
+ * BufferPool.cpp
+ *
+ *  Created on: May 8, 2021
+ *      Author: ubuntu
+ */
+
+#include "pssc/transport/tcp/BufferPool.h"
+
+namespace trs
+{
+
+static inline size_t ClassShift(size_t size)
+{
+    if (size <= ((size_t)1 << BufferPool::MIN_CLASS_SHIFT))
+    {
+        return BufferPool::MIN_CLASS_SHIFT;
+    }
+    return 64 - __builtin_clzll(size - 1);
+}
+
+BufferPool& BufferPool::Instance()
+{
+    // never destroyed, messages may still be released by detached threads at exit
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+BufferPool::BufferPool()
+    : maxCachedBytes(DEFAULT_MAX_CACHED_BYTES),
+      allocations(0), hits(0), misses(0), releases(0), frees(0),
+      cachedBytes(0), inUseBytes(0)
+{
+}
+
+std::uint8_t* BufferPool::Allocate(size_t size, size_t& capacity)
+{
+    ++allocations;
+
+    auto shift = ClassShift(size);
+    if (shift > MAX_CLASS_SHIFT)
+    {
+        ++misses;
+        capacity = size;
+        inUseBytes += capacity;
+        return new std::uint8_t[capacity];
+    }
+
+    capacity = (size_t)1 << shift;
+    inUseBytes += capacity;
+
+    auto& sizeClass = classes[shift - MIN_CLASS_SHIFT];
+    {
+        std::lock_guard<std::mutex> lck(sizeClass.mtx);
+        if (!sizeClass.buffers.empty())
+        {
+            auto buffer = sizeClass.buffers.back();
+            sizeClass.buffers.pop_back();
+            cachedBytes -= capacity;
+            ++hits;
+            return buffer;
+        }
+    }
+
+    ++misses;
+    return new std::uint8_t[capacity];
+}
+
+void BufferPool::Release(std::uint8_t* buffer, size_t capacity)
+{
+    ++releases;
+    inUseBytes -= capacity;
+
+    auto shift = ClassShift(capacity);
+    if (shift <= MAX_CLASS_SHIFT && ((size_t)1 << shift) == capacity
+            && cachedBytes + capacity <= maxCachedBytes)
+    {
+        auto& sizeClass = classes[shift - MIN_CLASS_SHIFT];
+        std::lock_guard<std::mutex> lck(sizeClass.mtx);
+        if (sizeClass.buffers.size() < DEFAULT_MAX_CACHED_PER_CLASS)
+        {
+            sizeClass.buffers.push_back(buffer);
+            cachedBytes += capacity;
+            return;
+        }
+    }
+
+    ++frees;
+    delete[] buffer;
+}
+
+BufferPool::Stats BufferPool::GetStats()
+{
+    Stats stats;
+    stats.allocations = allocations;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.releases = releases;
+    stats.frees = frees;
+    stats.cachedBytes = cachedBytes;
+    stats.inUseBytes = inUseBytes;
+    return stats;
+}
+
+}
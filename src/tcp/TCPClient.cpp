@@ -23,6 +23,19 @@ TCPClient::TCPClient(
     OnDisconnected = on_disconnected;
 }
 
+TCPClient::TCPClient(
+      std::string address,
+      int port,
+      std::function<void(std::shared_ptr<TCPConnection>)> on_connected,
+      std::function<void(std::shared_ptr<TCPConnection>)> on_disconnected
+      )
+  : ep(boost::asio::ip::address::from_string(address), port)
+{
+    sock = std::make_shared<tcp::socket>(ioContext);
+    OnConnected = on_connected;
+    OnDisconnected = on_disconnected;
+}
+
 void TCPClient::Run()  {
     boost::system::error_code ec;
     boost::asio::io_service::work work(ioContext);
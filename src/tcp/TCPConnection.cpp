@@ -7,6 +7,7 @@
 
 
 #include <glog/logging.h>
+#include "pssc/util/Log.h"
 #include "pssc/transport/tcp/TCPConnection.h"
 
 namespace trs
@@ -14,9 +15,34 @@ namespace trs
 
 TCPConnection::TCPConnection(std::shared_ptr<tcp::socket> sock,
         std::function<void(std::shared_ptr<TCPConnection>)> funcDisconnected)
-    : sock(sock), funcDisconnected(funcDisconnected)
+    : sock(sock), funcDisconnected(funcDisconnected),
+      strand(boost::asio::make_strand(sock->get_executor()))
 {
     running = true;
+    writing = false;
+    maxBatchBytes = DEFAULT_MAX_BATCH_BYTES;
+    queuedBytes = 0;
+    maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES;
+    droppedMessages = 0;
+    pendingMessages = 0;
+    pendingBytes = 0;
+    messagesIn = 0;
+    bytesIn = 0;
+    messagesOut = 0;
+    bytesOut = 0;
+    maxFragmentBytes = DEFAULT_MAX_FRAGMENT_BYTES;
+    maxRealtimeBytes = DEFAULT_MAX_REALTIME_BYTES;
+    static const size_t DEFAULT_WEIGHTS[PRIORITY_COUNT] = { 8, 4, 2, 1 };
+    for (size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        weights[i] = DEFAULT_WEIGHTS[i];
+        deficits[i] = 0;
+    }
+    bulkOffset = 0;
+    bulkFragmentBytes = 0;
+    sendingTotalLength = 0;
+    receivedOffset = 0;
+    receivingTotalLength = 0;
 }
 
 
@@ -25,12 +51,6 @@ TCPConnection::~TCPConnection() {}
 void TCPConnection::Start()
 {
     ReadHeader();
-
-    sendThread = std::thread(
-        std::bind(&TCPConnection::Run, this)
-    );
-
-    sendThread.detach();
 }
 
 void TCPConnection::Stop()
@@ -44,17 +64,48 @@ void TCPConnection::Stop()
     } catch (...) {
         DLOG(WARNING) << "exception in closing socket.";
     }
+}
 
+std::string TCPConnection::GetRemoteAddress()
+{
+    boost::system::error_code ec;
+    auto ep = sock->remote_endpoint(ec);
+    if (ec)
+    {
+        return "";
+    }
+    return ep.address().to_string();
+}
 
-//    if (sendThread.joinable())
-//    {
-//        sendThread.join();
-//    }
+std::string TCPConnection::GetLocalAddress()
+{
+    boost::system::error_code ec;
+    auto ep = sock->local_endpoint(ec);
+    if (ec)
+    {
+        return "";
+    }
+    return ep.address().to_string();
+}
+
+TCPConnection::Stats TCPConnection::GetStats()
+{
+    Stats stats;
+    stats.messagesIn = messagesIn.load(std::memory_order_relaxed);
+    stats.bytesIn = bytesIn.load(std::memory_order_relaxed);
+    stats.messagesOut = messagesOut.load(std::memory_order_relaxed);
+    stats.bytesOut = bytesOut.load(std::memory_order_relaxed);
+    stats.droppedMessages = droppedMessages;
+
+    std::lock_guard<std::mutex> lck(mtxSendQueue);
+    stats.queuedMessages = pendingMessages;
+    stats.queuedBytes = pendingBytes;
+    return stats;
 }
 
 void TCPConnection::ReadHeader()
 {
-    DLOG(INFO) << "ReadHeader";
+    PSSC_LOG(TRACE) << "ReadHeader";
 
     // for keep alive
     auto self = shared_from_this();
@@ -63,13 +114,14 @@ void TCPConnection::ReadHeader()
 
     boost::asio::async_read(
         *sock, boost::asio::buffer(header.get(), TCPMessage::SIZE_OF_HEADER),
-        std::bind(&TCPConnection::OnHeaderReceived, this, self, header, std::placeholders::_1, std::placeholders::_2));
+        boost::asio::bind_executor(strand,
+            std::bind(&TCPConnection::OnHeaderReceived, this, self, header, std::placeholders::_1, std::placeholders::_2)));
 }
 
 
 void TCPConnection::ReadBody(std::shared_ptr<TCPMessage::Header> header) {
 
-    DLOG(INFO) << "ReadBody";
+    PSSC_LOG(TRACE) << "ReadBody";
 
     auto self = shared_from_this();
 
@@ -77,7 +129,8 @@ void TCPConnection::ReadBody(std::shared_ptr<TCPMessage::Header> header) {
 
     boost::asio::async_read(
         *sock, boost::asio::buffer(msg->body, msg->header.bodyLength),
-        std::bind(&TCPConnection::OnBodyReceived, this, self, msg, std::placeholders::_1, std::placeholders::_2));
+        boost::asio::bind_executor(strand,
+            std::bind(&TCPConnection::OnBodyReceived, this, self, msg, std::placeholders::_1, std::placeholders::_2)));
 }
 
 void TCPConnection::OnHeaderReceived(std::shared_ptr<TCPConnection> self,
@@ -95,9 +148,19 @@ void TCPConnection::OnHeaderReceived(std::shared_ptr<TCPConnection> self,
         return;
     }
 
-    header->decode();
+    if (!header->decode())
+    {
+        Stop();
+        LOG(ERROR) << "unsupported framing version " << (int)header->version << ".";
+        funcDisconnected(shared_from_this());
+        return;
+    }
 
-    if (header->bodyLength > 0)
+    if (header->flags & TCPMessage::FLAG_FRAGMENT)
+    {
+        ReadFragment(header);
+    }
+    else if (header->bodyLength > 0)
     {
         ReadBody(header);
     }
@@ -105,7 +168,7 @@ void TCPConnection::OnHeaderReceived(std::shared_ptr<TCPConnection> self,
     {
         // for supporting multi-threads
         ReadHeader();
-        funcMessageReceived(TCPMessage::Generate(header));
+        OnMessageReceived(TCPMessage::Generate(header));
     }
 }
 
@@ -126,79 +189,472 @@ void TCPConnection::OnBodyReceived(std::shared_ptr<TCPConnection> self,
 
     // for supporting multi-threads
     ReadHeader();
-    funcMessageReceived(msg);
+    OnMessageReceived(msg);
 }
 
-void TCPConnection::Run()
+void TCPConnection::ReadFragment(std::shared_ptr<TCPMessage::Header> header)
 {
-    while (running)
+    auto self = shared_from_this();
+
+    if (receivingMessage != nullptr)
     {
-        std::unique_lock<std::mutex> lck(mtxSendQueue);
-        cvSendQueue.wait(lck, [this]()
+        size_t length = header->bodyLength;
+        if (receivedOffset + length > receivingMessage->header.bodyLength)
         {
-            return !sendQueue.empty();
-        });
+            LOG(ERROR) << "fragment beyond the length of its message.";
+            OnFailed();
+            return;
+        }
+
+        boost::asio::async_read(
+            *sock, boost::asio::buffer(receivingMessage->body + receivedOffset, length),
+            boost::asio::bind_executor(strand,
+                std::bind(&TCPConnection::OnFragmentReceived, this, self, header, length,
+                        std::placeholders::_1, std::placeholders::_2)));
+        return;
+    }
 
-        auto msg = sendQueue.front();
-        sendQueue.pop_front();
-        Send(msg);
+    // the first fragment, the whole body is allocated once its length is known
+    if (header->bodyLength < sizeof(receivingTotalLength))
+    {
+        LOG(ERROR) << "first fragment without the length of its message.";
+        OnFailed();
+        return;
     }
+
+    boost::asio::async_read(
+        *sock, boost::asio::buffer(&receivingTotalLength, sizeof(receivingTotalLength)),
+        boost::asio::bind_executor(strand,
+            [this, self, header](boost::system::error_code ec, std::size_t receivedLength)
+            {
+                if (ec != boost::system::errc::success || receivedLength != sizeof(receivingTotalLength))
+                {
+                    OnFailed();
+                    return;
+                }
+
+                receivingMessage = TCPMessage::Generate(ntohl(receivingTotalLength));
+                receivedOffset = 0;
+                header->bodyLength -= sizeof(receivingTotalLength);
+                ReadFragment(header);
+            }));
 }
 
-void TCPConnection::PendMessage(std::shared_ptr<TCPMessage> msg)
+void TCPConnection::OnFragmentReceived(std::shared_ptr<TCPConnection> self,
+        std::shared_ptr<TCPMessage::Header> header, size_t length,
+        boost::system::error_code ec, std::size_t receivedLength)
 {
+    if (ec != boost::system::errc::success || length != receivedLength)
     {
-        std::lock_guard<std::mutex> lck(mtxSendQueue);
-        sendQueue.emplace_back(msg);
+        OnFailed();
+        return;
+    }
+
+    receivedOffset += length;
+    if (!(header->flags & TCPMessage::FLAG_LAST))
+    {
+        ReadHeader();
+        return;
+    }
+
+    if (receivedOffset != receivingMessage->header.bodyLength)
+    {
+        LOG(ERROR) << "message ended before its length.";
+        OnFailed();
+        return;
     }
 
-    cvSendQueue.notify_one();
+    auto msg = std::move(receivingMessage);
+    receivingMessage = nullptr;
+
+    // for supporting multi-threads
+    ReadHeader();
+    OnMessageReceived(msg);
 }
 
+void TCPConnection::OnFailed()
+{
+    Stop();
+    DLOG(ERROR) << "an exception occurred after receive message.";
+    funcDisconnected(shared_from_this());
+}
 
-bool TCPConnection::Send(std::uint8_t* data, size_t size)
+void TCPConnection::OnMessageReceived(std::shared_ptr<TCPMessage> msg)
 {
-    boost::system::error_code ec;
-    size_t written = 0;
-    size_t restSize = size;
-    std::uint8_t* cache = data;
+    messagesIn.fetch_add(1, std::memory_order_relaxed);
+    bytesIn.fetch_add(msg->header.bodyLength, std::memory_order_relaxed);
+    if (util::Tracer::IsEnabled())
+    {
+        // recorded by the protocol once it knows which message it is
+        msg->trace.receivedAt = util::Tracer::Now();
+    }
+    funcMessageReceived(msg);
+}
 
-    // send message
-    do {
-        written = sock->write_some(
-            boost::asio::buffer(cache, restSize), ec);
-        if (ec)
+void TCPConnection::PendMessage(std::shared_ptr<TCPMessage> msg, Priority priority)
+{
+    std::lock_guard<std::mutex> lck(mtxSendQueue);
+    Enqueue(PendingMessage { msg, false, 0, false }, priority);
+    StartWriting();
+}
+
+void TCPConnection::PendMessage(std::shared_ptr<TCPMessage> msg, std::uint64_t key, Priority priority)
+{
+    std::lock_guard<std::mutex> lck(mtxSendQueue);
+    Enqueue(PendingMessage { msg, false, key, false }, priority);
+    StartWriting();
+}
+
+bool TCPConnection::PendMessage(std::shared_ptr<TCPMessage> msg, std::uint64_t key, const util::QueueLimit& limit,
+        Priority priority)
+{
+    std::lock_guard<std::mutex> lck(mtxSendQueue);
+    auto& count = queuedCounts[key];
+
+    // the oldest message of key to make room for this one, evicted only once it is accepted
+    std::deque<PendingMessage>* oldestQueue = nullptr;
+    std::deque<PendingMessage>::iterator oldest;
+    if (limit.depth > 0 && count >= limit.depth)
+    {
+        if (limit.policy == util::QueuePolicy::DROP_NEWEST)
         {
-            break;
+            ++droppedMessages;
+            return false;
         }
-        cache += written;
-        restSize -= written;
-    } while (ec == boost::system::errc::success && running && restSize > 0);
 
-    if (ec != boost::system::errc::success)
+        for (size_t i = 0; i < PRIORITY_COUNT && oldestQueue == nullptr; ++i)
+        {
+            oldest = FindDroppable(sendQueues[i], key, 0);
+            oldestQueue = oldest != sendQueues[i].end() ? &sendQueues[i] : nullptr;
+        }
+        if (oldestQueue == nullptr)
+        {
+            // the message being sent in fragments is kept
+            oldest = FindDroppable(bulkQueue, key, bulkOffset > 0 ? 1 : 0);
+            oldestQueue = oldest != bulkQueue.end() ? &bulkQueue : nullptr;
+        }
+        if (oldestQueue == nullptr)
+        {
+            // only the message being sent is queued, it is one over the depth until it is written
+            PSSC_LOG_EVERY_MS(WARNING, 1000) << "messages of key " << key
+                    << " exceed their depth while the oldest of them is being sent.";
+        }
+    }
+
+    // a slow peer must not exhaust the memory, a single large message still goes
+    auto remaining = queuedBytes - (oldestQueue != nullptr ? oldest->msg->header.bodyLength : 0);
+    if (remaining > 0 && remaining + msg->header.bodyLength > maxQueuedBytes)
     {
-        Stop();
-        DLOG(ERROR) << "a fatal error occurs while sending data, system exit.";
-        funcDisconnected(shared_from_this());
+        ++droppedMessages;
         return false;
     }
 
-    return true;
+    bool dropped = oldestQueue != nullptr;
+    if (dropped)
+    {
+        Dequeued(*oldest);
+        oldestQueue->erase(oldest);
+        ++droppedMessages;
+    }
+
+    ++count;
+    queuedBytes += msg->header.bodyLength;
+    Enqueue(PendingMessage { msg, true, key, false }, priority);
+    StartWriting();
+    return !dropped;
 }
 
-void TCPConnection::Send(std::shared_ptr<TCPMessage> msg)
+void TCPConnection::Enqueue(PendingMessage&& pending, Priority priority)
 {
-    auto header = msg->header;
+    auto bodyLength = pending.msg->header.bodyLength;
+    ++pendingMessages;
+    pendingBytes += bodyLength;
 
-    header.encode();
+    size_t queue = static_cast<size_t>(priority);
+    if (maxFragmentBytes > 0 && bodyLength > maxFragmentBytes)
+    {
+        queue = PRIORITY_COUNT;
+    }
+    else if (priority == Priority::REALTIME && bodyLength > maxRealtimeBytes)
+    {
+        queue = static_cast<size_t>(Priority::BULK);
+    }
 
-    DLOG(INFO) << "send data size:" << msg->header.bodyLength;
+    if (priority == Priority::REALTIME || priority == Priority::BULK)
+    {
+        // a message sent from another queue could overtake those of its key
+        auto& keyQueue = keyQueues[pending.key];
+        if (keyQueue.count > 0)
+        {
+            queue = keyQueue.queue;
+        }
+        keyQueue.queue = queue;
+        ++keyQueue.count;
+        pending.ordered = true;
+    }
 
-    if(Send((std::uint8_t*)&header, TCPMessage::SIZE_OF_HEADER)
-        && msg->header.bodyLength > 0)
+    if (queue == PRIORITY_COUNT)
     {
-        Send(msg->body, msg->header.bodyLength);
+        bulkQueue.emplace_back(std::move(pending));
     }
+    else
+    {
+        sendQueues[queue].emplace_back(std::move(pending));
+    }
+}
+
+void TCPConnection::Dequeued(const PendingMessage& pending)
+{
+    --pendingMessages;
+    pendingBytes -= pending.msg->header.bodyLength;
+    if (pending.droppable)
+    {
+        queuedBytes -= pending.msg->header.bodyLength;
+        --queuedCounts[pending.key];
+    }
+    if (pending.ordered)
+    {
+        auto keyQueue = keyQueues.find(pending.key);
+        if (--keyQueue->second.count == 0)
+        {
+            keyQueues.erase(keyQueue);
+        }
+    }
+}
+
+std::deque<TCPConnection::PendingMessage>::iterator TCPConnection::FindDroppable(
+        std::deque<PendingMessage>& queue, std::uint64_t key, size_t from)
+{
+    for (auto pending = queue.begin() + std::min(from, queue.size()); pending != queue.end(); ++pending)
+    {
+        if (pending->droppable && pending->key == key)
+        {
+            return pending;
+        }
+    }
+    return queue.end();
+}
+
+void TCPConnection::StartWriting()
+{
+    if (writing)
+    {
+        // will be sent after the current write
+        return;
+    }
+    writing = true;
+
+    // operations on the socket are started in the strand only
+    boost::asio::post(strand, std::bind(&TCPConnection::Write, shared_from_this()));
+}
+
+void TCPConnection::Write()
+{
+    // a slice of a large message, sent after the small messages of the batch
+    std::shared_ptr<TCPMessage> fragmented;
+    size_t fragmentOffset = 0;
+    size_t fragmentLength = 0;
+    bool lastFragment = false;
+    {
+        std::lock_guard<std::mutex> lck(mtxSendQueue);
+        bool empty = bulkQueue.empty();
+        for (size_t i = 0; i < PRIORITY_COUNT && empty; ++i)
+        {
+            empty = sendQueues[i].empty();
+        }
+        if (empty || !running)
+        {
+            writing = false;
+            return;
+        }
+
+        size_t batchBytes = 0;
+        if (!bulkQueue.empty())
+        {
+            auto& pending = bulkQueue.front();
+            fragmented = pending.msg;
+            fragmentOffset = bulkOffset;
+            if (bulkOffset == 0)
+            {
+                // fragmentation may have been turned off since it was queued
+                bulkFragmentBytes = maxFragmentBytes > 0 ? maxFragmentBytes : fragmented->header.bodyLength;
+            }
+            fragmentLength = std::min(bulkFragmentBytes, fragmented->header.bodyLength - bulkOffset);
+            bulkOffset += fragmentLength;
+            lastFragment = bulkOffset == fragmented->header.bodyLength;
+            batchBytes = TCPMessage::SIZE_OF_HEADER + fragmentLength;
+            if (lastFragment)
+            {
+                Dequeued(pending);
+                bulkQueue.pop_front();
+                bulkOffset = 0;
+            }
+        }
+
+        TakeBatch(batchBytes);
+    }
+
+    // headers and bodies of the batch in one gathered write
+    size_t count = sendingMessages.size();
+    size_t bytes = fragmentLength;
+    sendingHeaders.resize(count + (fragmented != nullptr ? 1 : 0));
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& msg = sendingMessages[i];
+        bytes += msg->header.bodyLength;
+        sendingHeaders[i] = msg->header;
+        sendingHeaders[i].encode();
+        sendingBuffers.emplace_back(boost::asio::buffer(&sendingHeaders[i], TCPMessage::SIZE_OF_HEADER));
+        if (msg->header.bodyLength > 0)
+        {
+            sendingBuffers.emplace_back(boost::asio::buffer(msg->body, msg->header.bodyLength));
+        }
+    }
+
+    if (fragmented != nullptr)
+    {
+        auto& header = sendingHeaders[count];
+        header = fragmented->header;
+        header.flags = TCPMessage::FLAG_FRAGMENT | (lastFragment ? TCPMessage::FLAG_LAST : 0);
+        header.bodyLength = fragmentLength;
+        if (fragmentOffset == 0)
+        {
+            header.bodyLength += sizeof(sendingTotalLength);
+        }
+        header.encode();
+        sendingBuffers.emplace_back(boost::asio::buffer(&header, TCPMessage::SIZE_OF_HEADER));
+        if (fragmentOffset == 0)
+        {
+            sendingTotalLength = htonl(fragmented->header.bodyLength);
+            sendingBuffers.emplace_back(boost::asio::buffer(&sendingTotalLength, sizeof(sendingTotalLength)));
+        }
+        sendingBuffers.emplace_back(boost::asio::buffer(fragmented->body + fragmentOffset, fragmentLength));
+        // kept alive until written
+        sendingMessages.emplace_back(std::move(fragmented));
+    }
+
+    messagesOut.fetch_add(count + (lastFragment ? 1 : 0), std::memory_order_relaxed);
+    bytesOut.fetch_add(bytes, std::memory_order_relaxed);
+
+    if (util::Tracer::IsEnabled())
+    {
+        // a fragmented message is sent with its last slice
+        auto now = util::Tracer::Now();
+        for (size_t i = 0; i < count + (lastFragment ? 1 : 0); ++i)
+        {
+            util::Tracer::Record(util::TracePoint::SEND, sendingMessages[i]->trace, now);
+        }
+    }
+
+    PSSC_LOG(TRACE) << "send messages:" << sendingMessages.size();
+
+    boost::asio::async_write(
+        *sock, sendingBuffers,
+        boost::asio::bind_executor(strand,
+            std::bind(&TCPConnection::OnWritten, this, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+}
+
+void TCPConnection::TakeBatch(size_t batchBytes)
+{
+    // deficit round robin over the classes until the batch reaches the cap
+    bool pending = true;
+    while (pending)
+    {
+        pending = false;
+        bool taken = false;
+        for (size_t i = 0; i < PRIORITY_COUNT; ++i)
+        {
+            auto& queue = sendQueues[i];
+            if (queue.empty())
+            {
+                deficits[i] = 0;
+                continue;
+            }
+
+            deficits[i] += weights[i] * QUANTUM_BYTES;
+            while (!queue.empty())
+            {
+                size_t size = TCPMessage::SIZE_OF_HEADER + queue.front().msg->header.bodyLength;
+                if (size > deficits[i])
+                {
+                    break;
+                }
+                if (batchBytes > 0 && batchBytes + size > maxBatchBytes)
+                {
+                    // full, the rest goes in the next write
+                    return;
+                }
+
+                auto& front = queue.front();
+                Dequeued(front);
+                sendingMessages.emplace_back(std::move(front.msg));
+                queue.pop_front();
+                deficits[i] -= size;
+                batchBytes += size;
+                taken = true;
+            }
+
+            if (queue.empty())
+            {
+                deficits[i] = 0;
+            }
+            else
+            {
+                pending = true;
+            }
+        }
+
+        if (pending && !taken)
+        {
+            // every head is larger than its deficit, e.g. a large message while
+            // fragmentation is off: add the rounds it takes one of them to fit at once
+            SkipRounds();
+        }
+    }
+}
+
+void TCPConnection::SkipRounds()
+{
+    size_t rounds = SIZE_MAX;
+    for (size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        if (!sendQueues[i].empty())
+        {
+            size_t size = TCPMessage::SIZE_OF_HEADER + sendQueues[i].front().msg->header.bodyLength;
+            size_t quantum = weights[i] * QUANTUM_BYTES;
+            rounds = std::min(rounds, (size - deficits[i] + quantum - 1) / quantum);
+        }
+    }
+
+    // the next round adds the last quantum
+    for (size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        if (!sendQueues[i].empty())
+        {
+            deficits[i] += (rounds - 1) * weights[i] * QUANTUM_BYTES;
+        }
+    }
+}
+
+void TCPConnection::OnWritten(std::shared_ptr<TCPConnection> self,
+        boost::system::error_code ec, std::size_t)
+{
+    sendingMessages.clear();
+    sendingBuffers.clear();
+
+    if (ec != boost::system::errc::success)
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtxSendQueue);
+            writing = false;
+        }
+        Stop();
+        DLOG(ERROR) << "a fatal error occurs while sending data.";
+        funcDisconnected(shared_from_this());
+        return;
+    }
+
+    Write();
 }
 
 }
@@ -6,6 +6,7 @@
  */
 
 #include <glog/logging.h>
+#include <vector>
 #include "pssc/transport/tcp/TCPServer.h"
 
 namespace trs
@@ -15,11 +16,13 @@ TCPServer::TCPServer(
       int port,
       std::function<void(std::shared_ptr<TCPConnection>)> funcConnected,
       std::function<void(std::shared_ptr<TCPConnection>)> funcDisconnected,
-      size_t maxConnection
+      size_t maxConnection,
+      size_t threadCount
       )
 {
     currentConnections = 0;
     this->maxConnection = maxConnection;
+    this->threadCount = threadCount > 0 ? threadCount : 1;
     OnConnected = funcConnected;
     OnDisconnected = funcDisconnected;
     ep = tcp::endpoint(tcp::v4(), port);
@@ -34,7 +37,23 @@ void TCPServer::Run()  {
 
     boost::system::error_code ec;
     boost::asio::io_service::work work(ioContext);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+    {
+        threads.emplace_back([this]()
+        {
+            boost::system::error_code ec;
+            ioContext.run(ec);
+        });
+    }
+
     ioContext.run(ec);
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
 }
 
 void TCPServer::Accept()